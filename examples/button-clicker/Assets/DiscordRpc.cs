@@ -63,6 +63,47 @@ public class DiscordRpc
         public bool instance;
     }
 
+    /// <summary>
+    /// UTF-8 bytes the library reads in place, no null terminator needed. Point it at pinned memory.
+    /// </summary>
+    [Serializable, StructLayout(LayoutKind.Sequential)]
+    public struct StringView
+    {
+        public IntPtr data;
+        public uint length;
+
+        public StringView(IntPtr data, int length)
+        {
+            this.data = data;
+            this.length = (uint)length;
+        }
+    }
+
+    /// <summary>
+    /// Blittable counterpart of <see cref="RichPresenceStruct"/> for <see cref="UpdatePresenceEx"/>;
+    /// a <see cref="StringView"/> with a zero data pointer leaves that field out.
+    /// </summary>
+    [Serializable, StructLayout(LayoutKind.Sequential)]
+    public struct RichPresenceExStruct
+    {
+        public StringView state; /* max 128 bytes */
+        public StringView details; /* max 128 bytes */
+        public long startTimestamp;
+        public long endTimestamp;
+        public StringView largeImageKey; /* max 32 bytes */
+        public StringView largeImageText; /* max 128 bytes */
+        public StringView smallImageKey; /* max 32 bytes */
+        public StringView smallImageText; /* max 128 bytes */
+        public StringView partyId; /* max 128 bytes */
+        public int partySize;
+        public int partyMax;
+        public int partyPrivacy;
+        public StringView matchSecret; /* max 128 bytes */
+        public StringView joinSecret; /* max 128 bytes */
+        public StringView spectateSecret; /* max 128 bytes */
+        public sbyte instance;
+    }
+
     [Serializable]
     public struct DiscordUser
     {
@@ -112,6 +153,12 @@ public class DiscordRpc
     [DllImport("discord-rpc", EntryPoint = "Discord_UpdatePresence", CallingConvention = CallingConvention.Cdecl)]
     private static extern void UpdatePresenceNative(ref RichPresenceStruct presence);
 
+    /// <summary>
+    /// Updates presence straight from the buffers the views point at, which only have to stay pinned for the call.
+    /// </summary>
+    [DllImport("discord-rpc", EntryPoint = "Discord_UpdatePresenceEx", CallingConvention = CallingConvention.Cdecl)]
+    public static extern void UpdatePresenceEx(ref RichPresenceExStruct presence);
+
     [DllImport("discord-rpc", EntryPoint = "Discord_ClearPresence", CallingConvention = CallingConvention.Cdecl)]
     public static extern void ClearPresence();
 
@@ -116,39 +116,46 @@ void UDiscordRpc::RunCallbacks()
     Discord_RunCallbacks();
 }
 
+static DiscordStringView ToView(const FTCHARToUTF8& utf8)
+{
+    return DiscordStringView{utf8.Get(), (uint32_t)utf8.Length()};
+}
+
 void UDiscordRpc::UpdatePresence()
 {
-    DiscordRichPresence rp{};
+    // The conversions live on the stack until the call returns, which is all
+    // Discord_UpdatePresenceEx needs; no copies and no strlen.
+    DiscordRichPresenceEx rp{};
 
-    auto state = StringCast<ANSICHAR>(*RichPresence.state);
-    rp.state = state.Get();
+    FTCHARToUTF8 state(*RichPresence.state);
+    rp.state = ToView(state);
 
-    auto details = StringCast<ANSICHAR>(*RichPresence.details);
-    rp.details = details.Get();
+    FTCHARToUTF8 details(*RichPresence.details);
+    rp.details = ToView(details);
 
-    auto largeImageKey = StringCast<ANSICHAR>(*RichPresence.largeImageKey);
-    rp.largeImageKey = largeImageKey.Get();
+    FTCHARToUTF8 largeImageKey(*RichPresence.largeImageKey);
+    rp.largeImageKey = ToView(largeImageKey);
 
-    auto largeImageText = StringCast<ANSICHAR>(*RichPresence.largeImageText);
-    rp.largeImageText = largeImageText.Get();
+    FTCHARToUTF8 largeImageText(*RichPresence.largeImageText);
+    rp.largeImageText = ToView(largeImageText);
 
-    auto smallImageKey = StringCast<ANSICHAR>(*RichPresence.smallImageKey);
-    rp.smallImageKey = smallImageKey.Get();
+    FTCHARToUTF8 smallImageKey(*RichPresence.smallImageKey);
+    rp.smallImageKey = ToView(smallImageKey);
 
-    auto smallImageText = StringCast<ANSICHAR>(*RichPresence.smallImageText);
-    rp.smallImageText = smallImageText.Get();
+    FTCHARToUTF8 smallImageText(*RichPresence.smallImageText);
+    rp.smallImageText = ToView(smallImageText);
 
-    auto partyId = StringCast<ANSICHAR>(*RichPresence.partyId);
-    rp.partyId = partyId.Get();
+    FTCHARToUTF8 partyId(*RichPresence.partyId);
+    rp.partyId = ToView(partyId);
 
-    auto matchSecret = StringCast<ANSICHAR>(*RichPresence.matchSecret);
-    rp.matchSecret = matchSecret.Get();
+    FTCHARToUTF8 matchSecret(*RichPresence.matchSecret);
+    rp.matchSecret = ToView(matchSecret);
 
-    auto joinSecret = StringCast<ANSICHAR>(*RichPresence.joinSecret);
-    rp.joinSecret = joinSecret.Get();
+    FTCHARToUTF8 joinSecret(*RichPresence.joinSecret);
+    rp.joinSecret = ToView(joinSecret);
 
-    auto spectateSecret = StringCast<ANSICHAR>(*RichPresence.spectateSecret);
-    rp.spectateSecret = spectateSecret.Get();
+    FTCHARToUTF8 spectateSecret(*RichPresence.spectateSecret);
+    rp.spectateSecret = ToView(spectateSecret);
     rp.startTimestamp = RichPresence.startTimestamp;
     rp.endTimestamp = RichPresence.endTimestamp;
     rp.partySize = RichPresence.partySize;
@@ -156,7 +163,7 @@ void UDiscordRpc::UpdatePresence()
     rp.partyPrivacy = (int)RichPresence.partyPrivacy;
     rp.instance = RichPresence.instance;
 
-    Discord_UpdatePresence(&rp);
+    Discord_UpdatePresenceEx(&rp);
 }
 
 void UDiscordRpc::ClearPresence()
@@ -42,6 +42,44 @@ typedef struct DiscordRichPresence {
     int8_t instance;
 } DiscordRichPresence;
 
+/* UTF-8 text that needs no null terminator; a NULL data pointer leaves the field out */
+typedef struct DiscordStringView {
+    const char* data;
+    uint32_t length;
+} DiscordStringView;
+
+/* DiscordRichPresence with sized strings, for Discord_UpdatePresenceEx */
+typedef struct DiscordRichPresenceEx {
+    DiscordStringView state;   /* max 128 bytes */
+    DiscordStringView details; /* max 128 bytes */
+    int64_t startTimestamp;
+    int64_t endTimestamp;
+    DiscordStringView largeImageKey;  /* max 32 bytes */
+    DiscordStringView largeImageText; /* max 128 bytes */
+    DiscordStringView smallImageKey;  /* max 32 bytes */
+    DiscordStringView smallImageText; /* max 128 bytes */
+    DiscordStringView partyId;        /* max 128 bytes */
+    int partySize;
+    int partyMax;
+    int partyPrivacy;
+    DiscordStringView matchSecret;    /* max 128 bytes */
+    DiscordStringView joinSecret;     /* max 128 bytes */
+    DiscordStringView spectateSecret; /* max 128 bytes */
+    int8_t instance;
+} DiscordRichPresenceEx;
+
+/* the parts of a presence template that change, see Discord_SetPresenceTemplate */
+#define DISCORD_PRESENCE_STATE 1
+#define DISCORD_PRESENCE_DETAILS 2
+#define DISCORD_PRESENCE_TIMESTAMPS 4
+
+typedef struct DiscordPresenceFields {
+    const char* state;   /* max 128 bytes */
+    const char* details; /* max 128 bytes */
+    int64_t startTimestamp;
+    int64_t endTimestamp;
+} DiscordPresenceFields;
+
 typedef struct DiscordUser {
     const char* userId;
     const char* username;
@@ -58,12 +96,66 @@ typedef struct DiscordEventHandlers {
     void (*joinRequest)(const DiscordUser* request);
 } DiscordEventHandlers;
 
+/* which command, as an index into DiscordStats.roundTrip */
+#define DISCORD_COMMAND_SET_ACTIVITY 0
+#define DISCORD_COMMAND_SUBSCRIBE 1
+#define DISCORD_COMMAND_UNSUBSCRIBE 2
+#define DISCORD_COMMAND_JOIN_REPLY 3
+#define DISCORD_COMMAND_OTHER 4
+#define DISCORD_COMMAND_KINDS 5
+
+/* how long messages waited: from being queued to being written to the socket, */
+/* or for DiscordStats.roundTrip from being written to Discord answering */
+typedef struct DiscordLatencyStats {
+    uint64_t count;       /* messages measured */
+    uint64_t totalMicros; /* divide by count for the average */
+    uint64_t maxMicros;
+} DiscordLatencyStats;
+
+typedef struct DiscordStats {
+    int64_t lastConnectMicros; /* socket connect to READY, latest connection */
+    uint64_t framesFiltered;   /* frames dropped unparsed, nobody handles them */
+    uint64_t writesDeferred;   /* writes held back, too much waiting to be sent */
+    uint32_t outboundPeakBytes; /* most bytes ever waiting for the socket */
+    uint64_t writeCalls;       /* send/sendmsg calls made */
+    uint64_t framesWritten;    /* frames handed to those calls */
+    uint64_t readCalls;        /* recv calls made */
+    uint64_t framesRead;       /* frames carved out of what they returned */
+    uint64_t presenceCoalesced; /* presence updates replaced by a newer one before being sent */
+    uint64_t presenceSkipped;  /* presence updates identical to the previous one, not sent */
+    uint64_t stringsTruncated; /* presence strings cut down to their documented max */
+    uint64_t commandsDropped;  /* commands refused because the send queue was full */
+    uint64_t commandsEvicted;  /* queued commands dropped to make room, DISCORD_QUEUE_DROP_OLDEST */
+    uint32_t sendQueuePeakBytes; /* most bytes ever waiting in the send queue */
+    DiscordLatencyStats controlLatency;  /* join replies and subscriptions, sent first */
+    DiscordLatencyStats presenceLatency; /* includes waiting for the presence rate limit */
+    DiscordLatencyStats commandLatency;  /* Discord_SendCommand, sent after presence */
+    DiscordLatencyStats roundTrip[DISCORD_COMMAND_KINDS]; /* successful replies by DISCORD_COMMAND_ */
+    uint64_t requestsErrored;    /* commands Discord answered with an error */
+    uint64_t requestsUnanswered; /* commands with no reply before timing out or disconnecting */
+    uint64_t rawEventsDropped;   /* raw events that didn't fit in the queue for Discord_RunCallbacks */
+} DiscordStats;
+
 #define DISCORD_REPLY_NO 0
 #define DISCORD_REPLY_YES 1
 #define DISCORD_REPLY_IGNORE 2
 #define DISCORD_PARTY_PRIVATE 0
 #define DISCORD_PARTY_PUBLIC 1
 
+/* what happens to a command when the send queue is full, see Discord_SetSendQueuePolicy */
+#define DISCORD_QUEUE_DROP_NEWEST 0 /* the new command is dropped, the default */
+#define DISCORD_QUEUE_DROP_OLDEST 1 /* queued commands are dropped, oldest first, until it fits */
+#define DISCORD_QUEUE_BLOCK 2       /* the caller waits up to limit ms for room */
+#define DISCORD_QUEUE_GROW 3        /* up to limit more bytes are queued outside the ring */
+
+/* what became of a command */
+#define DISCORD_SEND_QUEUED 0
+#define DISCORD_SEND_QUEUED_EVICTED 1 /* queued, older commands were dropped to make room */
+#define DISCORD_SEND_DROPPED -1       /* the send queue was full */
+#define DISCORD_SEND_TIMED_OUT -2     /* still full when the wait ran out */
+#define DISCORD_SEND_NOT_CONNECTED -3
+#define DISCORD_SEND_INVALID -4 /* couldn't be encoded */
+
 DISCORD_EXPORT void Discord_Initialize(const char* applicationId,
                                        const DiscordEventHandlers * handlers,
                                        int autoRegister,
@@ -73,18 +165,104 @@ DISCORD_EXPORT void Discord_Shutdown(void);
 /* checks for incoming messages, dispatches callbacks */
 DISCORD_EXPORT void Discord_RunCallbacks(void);
 
+/* Discord_RunCallbacks that stops after maxMicros or maxCallbacks callbacks, 0 meaning no limit */
+/* on either; each join request and raw event counts as one. It always runs at least one, and the */
+/* rest wait for the next call, in the same order. Returns 1 if some are still waiting. */
+/* elapsedMicros, if not NULL, gets how long it took */
+DISCORD_EXPORT int Discord_RunCallbacksBudgeted(uint32_t maxMicros,
+                                               uint32_t maxCallbacks,
+                                               uint32_t* elapsedMicros);
+
+/* A descriptor that is readable while Discord_RunCallbacks has something to do, for hosts that */
+/* would rather wait on it in their own event loop than call Discord_RunCallbacks every frame. */
+/* Only Discord_RunCallbacks makes it unreadable again; don't read from it. Valid from */
+/* Discord_Initialize to Discord_Shutdown, -1 on Windows */
+DISCORD_EXPORT int Discord_GetCallbackFd(void);
+
 /* If you disable the lib starting its own io thread, you'll need to call this from your own */
 #ifdef DISCORD_DISABLE_IO_THREAD
 DISCORD_EXPORT void Discord_UpdateConnection(void);
+
+/* Discord_UpdateConnection that stops after maxMicros or maxMessages, 0 meaning no limit on */
+/* either; every message read and every command written counts. It always gets at least one */
+/* read and one write through. Returns 1 if it stopped with work left, which the next call picks up (and */
+/* Discord_GetIoInterest asks for right away). elapsedMicros, if not NULL, gets how long it took */
+DISCORD_EXPORT int Discord_UpdateConnectionBudgeted(uint32_t maxMicros,
+                                                   uint32_t maxMessages,
+                                                   uint32_t* elapsedMicros);
+
+/* When Discord_UpdateConnection next has work: once fd is ready for what's asked, or after */
+/* timeoutMs, whichever comes first. Ask again after every call, and after updating presence or */
+/* sending anything; updates from other threads don't wake your loop */
+typedef struct DiscordIoInterest {
+    int fd;        /* ipc socket, -1 while there is none to wait on */
+    int wantRead;
+    int wantWrite; /* something is waiting to be written */
+    int timeoutMs; /* -1 for no deadline */
+} DiscordIoInterest;
+
+DISCORD_EXPORT void Discord_GetIoInterest(DiscordIoInterest* interest);
 #endif
 
 DISCORD_EXPORT void Discord_UpdatePresence(const DiscordRichPresence* presence);
 DISCORD_EXPORT void Discord_ClearPresence(void);
+/* same as Discord_UpdatePresence; the strings are read in place while it runs and never copied */
+DISCORD_EXPORT void Discord_UpdatePresenceEx(const DiscordRichPresenceEx* presence);
+
+/* Serializes presence once, leaving out the DISCORD_PRESENCE_* fields in openFields, so that */
+/* Discord_UpdatePresenceFields only has to fill those in. Call after Discord_Initialize, and not */
+/* while another thread is in Discord_UpdatePresenceFields. Returns 0 if it couldn't be built */
+DISCORD_EXPORT int Discord_SetPresenceTemplate(const DiscordRichPresence* presence, int openFields);
+/* updates presence to the template with these fields; does nothing without a template */
+DISCORD_EXPORT void Discord_UpdatePresenceFields(const DiscordPresenceFields* fields);
+
+/* presence goes out at most `burst` updates at once, then one every intervalMs; the newest waiting */
+/* update is what gets sent. Defaults to 2 and 5000, intervalMs <= 0 sends everything right away */
+DISCORD_EXPORT void Discord_SetPresenceRateLimit(int burst, int intervalMs);
 
-DISCORD_EXPORT void Discord_Respond(const char* userid, /* DISCORD_REPLY_ */ int reply);
+/* returns a DISCORD_SEND_ result */
+DISCORD_EXPORT int Discord_Respond(const char* userid, /* DISCORD_REPLY_ */ int reply);
+
+/* what became of a command sent with Discord_SendCommand */
+#define DISCORD_RESULT_OK 0           /* response is the data of Discord's reply */
+#define DISCORD_RESULT_ERROR 1        /* response is the data of the ERROR reply, with code and message */
+#define DISCORD_RESULT_TIMED_OUT 2    /* no reply within 10 seconds */
+#define DISCORD_RESULT_DISCONNECTED 3 /* the connection dropped before a reply came */
+
+/* Called on the io thread (or from Discord_UpdateConnection without one). response is raw JSON, */
+/* not null terminated, only valid during the call, and NULL unless Discord replied */
+typedef void (*DiscordCommandCallback)(void* userdata, int result, const char* response, uint32_t length);
+
+/* Sends any command, with argsJson (a JSON value, {} when argsLength is 0) passed through as is. */
+/* Returns a DISCORD_SEND_ result; callback, which may be NULL, is called exactly once if the */
+/* command was queued. The whole command has to fit in the send queue */
+DISCORD_EXPORT int Discord_SendCommand(const char* cmd,
+                                       const char* argsJson,
+                                       uint32_t argsLength,
+                                       DiscordCommandCallback callback,
+                                       void* userdata);
+
+/* DISCORD_QUEUE_ policy for commands that find the send queue full; limit is in ms for */
+/* DISCORD_QUEUE_BLOCK and in bytes for DISCORD_QUEUE_GROW. Never blocks the io thread. */
+/* Discord_SendCommand commands are never evicted, DISCORD_QUEUE_DROP_OLDEST drops the newest of those */
+DISCORD_EXPORT void Discord_SetSendQueuePolicy(int policy, int limit);
 
 DISCORD_EXPORT void Discord_UpdateHandlers(DiscordEventHandlers* handlers);
 
+/* where raw events get delivered, see Discord_SetRawEventHandler */
+#define DISCORD_RAW_EVENTS_RUN_CALLBACKS 0 /* copied into a queue, handed out by Discord_RunCallbacks */
+#define DISCORD_RAW_EVENTS_IO_THREAD 1     /* straight out of the receive buffer, on the io thread */
+
+/* json is the event's data member as it came in, not null terminated; only valid during the call */
+typedef void (*DiscordRawEventCallback)(const char* evtName, const char* json, uint32_t length);
+
+/* Hands every event Discord sends to handler, unparsed, next to the handlers that know the event. */
+/* Discord only sends events something subscribed to. NULL turns it off */
+DISCORD_EXPORT void Discord_SetRawEventHandler(DiscordRawEventCallback handler, int delivery);
+
+/* snapshot of internal counters and timings, safe to call from any thread */
+DISCORD_EXPORT void Discord_GetStats(DiscordStats* stats);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <thread>
+
+// Variable sized messages back to back in one ring of bytes, each behind a
+// small header. A message never wraps around; if it doesn't fit before the
+// end of the ring, the rest of the ring is skipped. No locks; any number of
+// threads can add, a single thread consumes.
+//
+// Adding claims space by moving head_ forward with a compare exchange, copies
+// the message in and then publishes its header. Headers carry the position
+// they were written for, so whatever was left in the ring from an earlier
+// lap never passes for a finished message; the consumer stops at the first
+// message that isn't finished yet. The tag is never 0, or the zeroed ring of
+// a fresh queue would read as an empty message at position 0.
+//
+// tail_ is the oldest message still queued. Producers asked to make room
+// move it past the oldest message themselves, except while the consumer has
+// it pinned (the Sending bit) between BeginSend() and EndSend(). Space only
+// gets reused once freed_ moves past it.
+
+template <size_t Capacity> class ByteQueue {
+  using Header = uint64_t; // position tag << 32 | length
+  static constexpr uint32_t Skip = UINT32_MAX;
+  static constexpr size_t Align = sizeof(Header);
+  static constexpr size_t Sending = 1; // in tail_, positions are always aligned
+  static_assert(Capacity % Align == 0 && Capacity > Align, "capacity must be a multiple of the header size");
+
+  alignas(Header) char ring_[Capacity];
+  // Running byte counts, never wrapped; the ring offset is the count modulo
+  // Capacity.
+  std::atomic_size_t head_{0};
+  std::atomic_size_t tail_{0};
+  std::atomic_size_t freed_{0};
+  std::atomic_uint64_t evicted_{0};
+  std::atomic_size_t peakBytes_{0};
+
+  static size_t Padded(size_t length) { return (length + Align - 1) & ~(Align - 1); }
+  static Header MakeHeader(size_t position, uint32_t length) {
+    uint32_t tag = static_cast<uint32_t>(position / Align);
+    if (!++tag) {
+      tag = 1;
+    }
+    return static_cast<Header>(tag) << 32 | length;
+  }
+
+  std::atomic_ref<Header> HeaderAt(size_t position) {
+    return std::atomic_ref<Header>(*reinterpret_cast<Header *>(ring_ + position % Capacity));
+  }
+
+  // Length of the finished message at position, moving position over a
+  // skipped end of the ring first. False if it isn't finished (yet).
+  bool MessageAt(size_t &position, uint32_t &length) {
+    Header header = HeaderAt(position).load(std::memory_order_acquire);
+    if (header != MakeHeader(position, static_cast<uint32_t>(header))) {
+      return false;
+    }
+    if (static_cast<uint32_t>(header) == Skip) {
+      position += Capacity - position % Capacity;
+      header = HeaderAt(position).load(std::memory_order_acquire);
+      if (header != MakeHeader(position, static_cast<uint32_t>(header))) {
+        return false;
+      }
+    }
+    length = static_cast<uint32_t>(header);
+    return true;
+  }
+
+  void FreeUpTo(size_t position) {
+    size_t freed = freed_.load(std::memory_order_relaxed);
+    while (freed < position && !freed_.compare_exchange_weak(freed, position, std::memory_order_release)) {
+    }
+  }
+
+  // Drops the oldest queued message. False if there is none that's finished.
+  bool EvictOldest() {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    for (;;) {
+      if (tail & Sending) {
+        // the consumer is only ever pinned for one non-blocking write
+        std::this_thread::yield();
+        tail = tail_.load(std::memory_order_acquire);
+        continue;
+      }
+      size_t position = tail;
+      uint32_t length;
+      if (!MessageAt(position, length)) {
+        return false;
+      }
+      const size_t next = position + sizeof(Header) + Padded(length);
+      if (tail_.compare_exchange_weak(tail, next, std::memory_order_acq_rel)) {
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+        FreeUpTo(next);
+        return true;
+      }
+    }
+  }
+
+public:
+  enum class AddResult { Added, AddedAfterEvicting, Full };
+
+  ByteQueue() {}
+
+  // Copies the parts in, back to back as one message. With evictOldest, the
+  // oldest messages are dropped until it fits; otherwise a full queue refuses
+  // it.
+  AddResult Add(const std::span<const std::string_view> parts, bool evictOldest) {
+    size_t length = 0;
+    for (const auto part : parts) {
+      length += part.size();
+    }
+    const size_t needed = sizeof(Header) + Padded(length);
+    if (length >= Skip || needed > Capacity) {
+      return AddResult::Full;
+    }
+    bool evicted = false;
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t skip;
+    for (;;) {
+      const size_t offset = head % Capacity;
+      skip = offset + needed > Capacity ? Capacity - offset : 0;
+      if (head + skip + needed - freed_.load(std::memory_order_acquire) > Capacity) {
+        if (evictOldest && EvictOldest()) {
+          evicted = true;
+          head = head_.load(std::memory_order_relaxed);
+          continue;
+        }
+        return AddResult::Full;
+      }
+      if (head_.compare_exchange_weak(head, head + skip + needed, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    if (skip) {
+      HeaderAt(head).store(MakeHeader(head, Skip), std::memory_order_release);
+      head += skip;
+    }
+    char *out = ring_ + head % Capacity + sizeof(Header);
+    for (const auto part : parts) {
+      if (!part.empty()) {
+        std::memcpy(out, part.data(), part.size());
+        out += part.size();
+      }
+    }
+    HeaderAt(head).store(MakeHeader(head, static_cast<uint32_t>(length)), std::memory_order_release);
+
+    const size_t used = head + needed - freed_.load(std::memory_order_relaxed);
+    size_t peak = peakBytes_.load(std::memory_order_relaxed);
+    while (used > peak && !peakBytes_.compare_exchange_weak(peak, used)) {
+    }
+    return evicted ? AddResult::AddedAfterEvicting : AddResult::Added;
+  }
+
+  // Consumer side. BeginSend() pins the queued messages and returns where
+  // they start; walk them in order by passing the position to PeekSend(),
+  // which moves it past the message it returns, false once there are no
+  // more. EndSend() takes the messages before position for good and unpins.
+  size_t BeginSend() { return tail_.fetch_or(Sending, std::memory_order_acq_rel) & ~Sending; }
+  bool PeekSend(size_t &position, std::string_view &message) {
+    uint32_t length;
+    if (!MessageAt(position, length)) {
+      return false;
+    }
+    message = {ring_ + position % Capacity + sizeof(Header), length};
+    position += sizeof(Header) + Padded(length);
+    return true;
+  }
+  void EndSend(size_t position) {
+    tail_.store(position, std::memory_order_release);
+    FreeUpTo(position);
+  }
+  bool HavePendingSends() {
+    size_t position = tail_.load(std::memory_order_acquire) & ~Sending;
+    uint32_t length;
+    return MessageAt(position, length);
+  }
+
+  uint64_t Evicted() const { return evicted_.load(); }
+  size_t PeakBytes() const { return peakBytes_.load(); }
+};
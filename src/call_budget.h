@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Caps how much work one call does: a time limit, a number of items, or
+// both, 0 meaning no limit. The first item is always allowed, so every call
+// makes progress however small the budget.
+struct CallBudget {
+  using Clock = std::chrono::steady_clock;
+
+  Clock::time_point start;
+  Clock::time_point deadline;
+  uint32_t itemsLeft;
+  uint32_t spent;
+
+  CallBudget(const uint32_t maxMicros, const uint32_t maxItems)
+      : start(Clock::now()),
+        deadline(maxMicros ? start + std::chrono::microseconds{maxMicros} : Clock::time_point::max()),
+        itemsLeft(maxItems ? maxItems : UINT32_MAX), spent(0) {}
+
+  static CallBudget unlimited() { return {0, 0}; }
+
+  bool exhausted() const {
+    return spent && (!itemsLeft || (deadline != Clock::time_point::max() && Clock::now() >= deadline));
+  }
+
+  void spend(const uint32_t items = 1) {
+    spent += items;
+    if (itemsLeft != UINT32_MAX) {
+      itemsLeft = items < itemsLeft ? itemsLeft - items : 0;
+    }
+  }
+
+  uint32_t elapsedMicros() const {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+  }
+};
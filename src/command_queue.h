@@ -0,0 +1,240 @@
+#pragma once
+
+#include "byte_queue.h"
+#include "connection.h"
+#include "latency_stats.h"
+#include "pending_requests.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+
+// The outgoing command queue: a ByteQueue plus a choice of what happens once
+// it's full. Any thread can add; a single thread sends.
+//
+// DropNewest refuses the new command, DropOldest evicts queued ones until it
+// fits, Block waits up to limit milliseconds for room (except on the sending
+// thread, which would wait for itself), and Grow keeps up to limit more bytes
+// in an overflow list that goes out once the ring is empty. The overflow
+// takes a lock, but only once the ring has filled up.
+//
+// Every command carries the time it was queued and its RequestInfo in front
+// of it, so the sending side can tell how long it waited and what it was.
+
+template <size_t Capacity, size_t MaxBatch> class CommandQueue {
+public:
+  enum class Policy { DropNewest, DropOldest, Block, Grow };
+  enum class Result { Queued, QueuedAfterEvicting, Dropped, TimedOut };
+
+private:
+  using Ring = ByteQueue<Capacity>;
+  static constexpr size_t MaxParts = 4;
+  using Clock = std::chrono::steady_clock;
+  struct Stamp {
+    Clock::rep queuedAt;
+    RequestInfo info;
+  };
+
+  Ring ring_;
+  std::atomic<Policy> policy_{Policy::DropNewest};
+  std::atomic_int limit_{0};
+  std::atomic_uint64_t dropped_{0};
+
+  std::mutex overflowMutex_;
+  std::deque<std::string> overflow_;
+  size_t overflowBytes_{0};
+  std::atomic_bool overflowPending_{false};
+
+  // sending thread only
+  size_t sendStart_{0};
+  size_t sendEnds_[MaxBatch];
+  Clock::rep sendQueuedAt_[MaxBatch];
+  // overflow being sent, moved out so the lock isn't held while it's written
+  std::string overflowBatch_[MaxBatch];
+  size_t overflowBatchCount_{0};
+  LatencyStats latency_;
+
+  Result Drop(Result result) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+  static std::string_view View(const Stamp &stamp) {
+    return {reinterpret_cast<const char *>(&stamp), sizeof(stamp)};
+  }
+
+  // Where the command behind the stamp starts; the rest is kept for EndSend.
+  void Unstamp(const std::string_view message, const size_t index, IoSlice *slices, RequestInfo *infos) {
+    Stamp stamp;
+    std::memcpy(&stamp, message.data(), sizeof(Stamp));
+    sendQueuedAt_[index] = stamp.queuedAt;
+    infos[index] = stamp.info;
+    slices[index] = {message.data() + sizeof(Stamp), message.size() - sizeof(Stamp)};
+  }
+
+  // parts[0] is the stamp
+  Result AddOverflow(const std::span<const std::string_view> parts) {
+    size_t length = 0;
+    for (const auto part : parts.subspan(1)) {
+      length += part.size();
+    }
+    std::lock_guard guard(overflowMutex_);
+    if (overflowBytes_ + length > static_cast<size_t>(std::max(limit_.load(), 0))) {
+      return Drop(Result::Dropped);
+    }
+    std::string &queued = overflow_.emplace_back();
+    queued.reserve(sizeof(Stamp) + length);
+    for (const auto part : parts) {
+      queued.append(part);
+    }
+    overflowBytes_ += length;
+    overflowPending_.store(true);
+    return Result::Queued;
+  }
+
+public:
+  CommandQueue() {}
+
+  void SetPolicy(Policy policy, int limit) {
+    limit_.store(limit);
+    policy_.store(policy);
+  }
+
+  // The command is the parts put together, at most MaxParts of them.
+  Result Add(const RequestInfo &info, const std::span<const std::string_view> command, bool canWait) {
+    if (command.size() > MaxParts) {
+      return Drop(Result::Dropped);
+    }
+    const Stamp stamp{Clock::now().time_since_epoch().count(), info};
+    std::string_view partsBuffer[MaxParts + 1]{View(stamp)};
+    std::copy(command.begin(), command.end(), partsBuffer + 1);
+    const std::span<const std::string_view> parts{partsBuffer, command.size() + 1};
+
+    const Policy policy = policy_.load();
+    if (policy == Policy::Grow && overflowPending_.load()) {
+      // behind what already overflowed, to keep the order
+      return AddOverflow(parts);
+    }
+
+    auto added = ring_.Add(parts, policy == Policy::DropOldest);
+    if (added == Ring::AddResult::Full && policy == Policy::Block && canWait) {
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{limit_.load()};
+      while (added == Ring::AddResult::Full && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        added = ring_.Add(parts, false);
+      }
+      if (added == Ring::AddResult::Full) {
+        return Drop(Result::TimedOut);
+      }
+    }
+
+    switch (added) {
+    case Ring::AddResult::Added:
+      return Result::Queued;
+    case Ring::AddResult::AddedAfterEvicting:
+      return Result::QueuedAfterEvicting;
+    case Ring::AddResult::Full:
+      break;
+    }
+    return policy == Policy::Grow ? AddOverflow(parts) : Drop(Result::Dropped);
+  }
+  Result Add(const RequestInfo &info, const void *data, size_t length, bool canWait) {
+    const std::string_view command{static_cast<const char *>(data), length};
+    return Add(info, {&command, 1}, canWait);
+  }
+
+  // Sending side. BeginSend() points slices at up to max queued commands,
+  // oldest first, with what they are in infos; they stay put until EndSend()
+  // says how many of them were taken, and those count towards Latency(). The
+  // rest stay queued. Always pair the two.
+  size_t BeginSend(IoSlice *slices, RequestInfo *infos, size_t max) {
+    if (max > MaxBatch) {
+      max = MaxBatch;
+    }
+    size_t count = 0;
+    sendStart_ = ring_.BeginSend();
+    size_t position = sendStart_;
+    std::string_view message;
+    while (count < max && ring_.PeekSend(position, message)) {
+      if (message.size() < sizeof(Stamp)) {
+        // never something Add() wrote; drop it once it's at the front
+        if (count) {
+          break;
+        }
+        sendStart_ = position;
+        continue;
+      }
+      sendEnds_[count] = position;
+      Unstamp(message, count++, slices, infos);
+    }
+
+    if (!count && overflowPending_.load()) {
+      // overflowPending_ stays set, so anything added meanwhile still goes
+      // in behind these
+      std::lock_guard guard(overflowMutex_);
+      for (; count < max && !overflow_.empty(); ++count) {
+        overflowBatch_[count] = std::move(overflow_.front());
+        overflow_.pop_front();
+        Unstamp(overflowBatch_[count], count, slices, infos);
+      }
+      overflowBatchCount_ = count;
+    }
+    return count;
+  }
+  void EndSend(size_t taken) {
+    const auto now = Clock::now();
+    for (size_t i = 0; i < taken; ++i) {
+      latency_.record(now - Clock::time_point{Clock::duration{sendQueuedAt_[i]}});
+    }
+    Take(taken);
+  }
+  bool HavePendingSends() { return ring_.HavePendingSends() || overflowPending_.load(); }
+
+  // Empties the queue without sending anything, handing what each command
+  // was to cleared(info), oldest first. Sending side.
+  template <typename Fn> void Clear(Fn cleared) {
+    IoSlice slices[MaxBatch];
+    RequestInfo infos[MaxBatch];
+    for (;;) {
+      const size_t count = BeginSend(slices, infos, MaxBatch);
+      for (size_t i = 0; i < count; ++i) {
+        cleared(infos[i]);
+      }
+      Take(count);
+      if (!count) {
+        break;
+      }
+    }
+  }
+
+  uint64_t Dropped() const { return dropped_.load(); }
+  uint64_t Evicted() const { return ring_.Evicted(); }
+  size_t PeakBytes() const { return ring_.PeakBytes(); }
+  const LatencyStats &Latency() const { return latency_; }
+
+private:
+  // Drops the first taken commands of the batch and unpins the rest.
+  void Take(size_t taken) {
+    if (overflowBatchCount_) {
+      ring_.EndSend(sendStart_);
+      std::lock_guard guard(overflowMutex_);
+      for (size_t i = 0; i < taken; ++i) {
+        overflowBytes_ -= overflowBatch_[i].size() - sizeof(Stamp);
+      }
+      // the rest go back in front, where they came from
+      for (size_t i = overflowBatchCount_; i > taken; --i) {
+        overflow_.push_front(std::move(overflowBatch_[i - 1]));
+      }
+      overflowBatchCount_ = 0;
+      overflowPending_.store(!overflow_.empty());
+      return;
+    }
+    ring_.EndSend(taken ? sendEnds_[taken - 1] : sendStart_);
+  }
+};
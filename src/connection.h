@@ -8,12 +8,27 @@
 // not really connectiony, but need per-platform
 int GetProcessId();
 
+// One piece of a gather write.
+struct IoSlice {
+  const void *data;
+  size_t length;
+};
+
 struct BaseConnection {
   static BaseConnection *Create();
   static void Destroy(BaseConnection *&);
   bool isOpen{false};
   bool Open();
   bool Close();
-  bool Write(const void *data, size_t length);
-  bool Read(void *data, size_t length);
+  // Writes as much as the connection takes without blocking and returns how
+  // much that was. 0 can also mean the connection went away (see isOpen).
+  size_t Write(const void *data, size_t length);
+  // Same as Write, for several buffers at once in a single call where the
+  // platform allows it.
+  size_t WriteV(const IoSlice *slices, size_t count);
+  // Reads whatever is available, up to length bytes. Returns 0 if there was
+  // nothing to read or the connection went away (see isOpen).
+  size_t Read(void *data, size_t length);
+  // Descriptor to wait on for readiness, -1 when closed or not pollable.
+  int PollFd() const;
 };
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -81,35 +82,76 @@ bool BaseConnection::Close() {
   return true;
 }
 
-bool BaseConnection::Write(const void *data, size_t length) {
+int BaseConnection::PollFd() const {
+  auto self = reinterpret_cast<const BaseConnectionUnix *>(this);
+  return self->sock;
+}
+
+size_t BaseConnection::Write(const void *data, size_t length) {
   auto self = reinterpret_cast<BaseConnectionUnix *>(this);
 
   if (self->sock == -1) {
-    return false;
+    return 0;
   }
 
   ssize_t sentBytes = send(self->sock, data, length, MsgFlags);
   if (sentBytes < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
     Close();
+    return 0;
   }
-  return sentBytes == (ssize_t)length;
+  return (size_t)sentBytes;
 }
 
-bool BaseConnection::Read(void *data, size_t length) {
+size_t BaseConnection::WriteV(const IoSlice *slices, size_t count) {
   auto self = reinterpret_cast<BaseConnectionUnix *>(this);
 
   if (self->sock == -1) {
-    return false;
+    return 0;
+  }
+
+  iovec iov[64];
+  if (count > sizeof(iov) / sizeof(iov[0])) {
+    count = sizeof(iov) / sizeof(iov[0]);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    iov[i].iov_base = const_cast<void *>(slices[i].data);
+    iov[i].iov_len = slices[i].length;
+  }
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  ssize_t sentBytes = sendmsg(self->sock, &msg, MsgFlags);
+  if (sentBytes < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
+    Close();
+    return 0;
+  }
+  return (size_t)sentBytes;
+}
+
+size_t BaseConnection::Read(void *data, size_t length) {
+  auto self = reinterpret_cast<BaseConnectionUnix *>(this);
+
+  if (self->sock == -1) {
+    return 0;
   }
 
-  int res = (int)recv(self->sock, data, length, MsgFlags);
+  ssize_t res = recv(self->sock, data, length, MsgFlags);
   if (res < 0) {
-    if (errno == EAGAIN) {
-      return false;
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
     }
     Close();
-  } else if (res == 0) {
+    return 0;
+  }
+  if (res == 0) {
     Close();
   }
-  return res == (int)length;
+  return (size_t)res;
 }
@@ -60,52 +60,73 @@ bool BaseConnection::Close() {
   return true;
 }
 
-bool BaseConnection::Write(const void *data, size_t length) {
+// named pipe handles can't go into a poll set
+int BaseConnection::PollFd() const { return -1; }
+
+size_t BaseConnection::Write(const void *data, size_t length) {
   if (length == 0) {
-    return true;
+    return 0;
   }
   auto self = reinterpret_cast<BaseConnectionWin *>(this);
   assert(self);
   if (!self) {
-    return false;
+    return 0;
   }
   if (self->pipe == INVALID_HANDLE_VALUE) {
-    return false;
+    return 0;
   }
   assert(data);
   if (!data) {
-    return false;
+    return 0;
   }
   const DWORD bytesLength = (DWORD)length;
   DWORD bytesWritten = 0;
-  return ::WriteFile(self->pipe, data, bytesLength, &bytesWritten, nullptr) ==
-             TRUE &&
-         bytesWritten == bytesLength;
+  if (::WriteFile(self->pipe, data, bytesLength, &bytesWritten, nullptr) !=
+      TRUE) {
+    Close();
+    return 0;
+  }
+  return bytesWritten;
 }
 
-bool BaseConnection::Read(void *data, size_t length) {
+size_t BaseConnection::WriteV(const IoSlice *slices, size_t count) {
+  // no gather writes on pipes, so one WriteFile per slice
+  size_t written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (slices[i].length == 0) {
+      continue;
+    }
+    const size_t sent = Write(slices[i].data, slices[i].length);
+    written += sent;
+    if (sent != slices[i].length) {
+      break;
+    }
+  }
+  return written;
+}
+
+size_t BaseConnection::Read(void *data, size_t length) {
   assert(data);
   if (!data) {
-    return false;
+    return 0;
   }
   auto self = reinterpret_cast<BaseConnectionWin *>(this);
   assert(self);
   if (!self) {
-    return false;
+    return 0;
   }
   if (self->pipe == INVALID_HANDLE_VALUE) {
-    return false;
+    return 0;
   }
   DWORD bytesAvailable = 0;
   if (::PeekNamedPipe(self->pipe, nullptr, 0, nullptr, &bytesAvailable,
                       nullptr)) {
-    if (bytesAvailable >= length) {
-      DWORD bytesToRead = (DWORD)length;
+    if (bytesAvailable > 0) {
+      DWORD bytesToRead = (DWORD)(length < bytesAvailable ? length : bytesAvailable);
       DWORD bytesRead = 0;
       if (::ReadFile(self->pipe, data, bytesToRead, &bytesRead, nullptr) ==
           TRUE) {
-        assert(bytesToRead == bytesRead);
-        return true;
+        return bytesRead;
       } else {
         Close();
       }
@@ -113,5 +134,5 @@ bool BaseConnection::Read(void *data, size_t length) {
   } else {
     Close();
   }
-  return false;
+  return 0;
 }
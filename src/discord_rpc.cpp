@@ -1,36 +1,49 @@
 #include "discord_rpc.h"
 
 #include "backoff.h"
+#include "byte_queue.h"
+#include "call_budget.h"
+#include "command_queue.h"
 #include "discord_register.h"
+#include "io_poller.h"
+#include "latency_stats.h"
 #include "msg_queue.h"
+#include "pending_requests.h"
 #include "rpc_connection.h"
 #include "serialization.h"
+#include "token_bucket.h"
+#include "triple_buffer.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <mutex>
 
-#include <glaze/glaze.hpp>
-
 #ifndef DISCORD_DISABLE_IO_THREAD
-#include <condition_variable>
 #include <thread>
 #endif
 
 constexpr size_t MaxMessageSize{16 * 1024};
-constexpr size_t MessageQueueSize{8};
+// Subscriptions and join replies are a hundred bytes or so; the send queue
+// only takes what they need out of DISCORD_SEND_QUEUE_BYTES.
+constexpr size_t MaxCommandSize{1024};
+#ifndef DISCORD_SEND_QUEUE_BYTES
+#define DISCORD_SEND_QUEUE_BYTES 8192
+#endif
 constexpr size_t JoinQueueSize{8};
+// Room for raw events waiting for Discord_RunCallbacks; most are well under
+// a kilobyte, so this rides out a burst of a few dozen.
+constexpr size_t RawEventQueueBytes{64 * 1024};
+// Discord answers in a few milliseconds; anything past this isn't coming.
+constexpr size_t MaxPendingRequests{64};
+constexpr std::chrono::seconds RequestTimeout{10};
 
 struct QueuedMessage {
   size_t length;
+  int nonce;
+  std::chrono::steady_clock::time_point queuedAt;
   char buffer[MaxMessageSize];
-
-  void Copy(const QueuedMessage &other) {
-    length = other.length;
-    if (length) {
-      memcpy(buffer, other.buffer, length);
-    }
-  }
 };
 
 struct User {
@@ -48,59 +61,134 @@ struct User {
   // changes in these sizes
 };
 
+static bool HasUser(const UserData &user) {
+  return !user.id.empty() && !user.username.empty();
+}
+
+static void CopyUser(User &dest, const UserData &src) {
+  JsonStringCopy(dest.userId, src.id);
+  JsonStringCopy(dest.username, src.username);
+  JsonStringCopy(dest.discriminator, src.discriminator);
+  JsonStringCopy(dest.avatar, src.avatar);
+}
+
 static RpcConnection *Connection{nullptr};
 static DiscordEventHandlers QueuedHandlers{};
 static DiscordEventHandlers Handlers{};
-static std::atomic_bool WasJustConnected{false};
-static std::atomic_bool WasJustDisconnected{false};
-static std::atomic_bool GotErrorMessage{false};
-static std::atomic_bool WasJoinGame{false};
-static std::atomic_bool WasSpectateGame{false};
-static std::atomic_bool UpdatePresence{false};
+// What Discord_RunCallbacks has to do, one bit per kind of callback, so an
+// idle call costs a single load. NotifierRaised says Notifier was raised
+// for what's in here; only the first bit set after Discord_RunCallbacks
+// emptied the mask raises it again.
+constexpr unsigned ConnectedCallback{1 << 0};
+constexpr unsigned DisconnectedCallback{1 << 1};
+constexpr unsigned ErrorCallback{1 << 2};
+constexpr unsigned JoinGameCallback{1 << 3};
+constexpr unsigned SpectateGameCallback{1 << 4};
+constexpr unsigned JoinRequestCallback{1 << 5};
+constexpr unsigned RawEventCallback{1 << 6};
+constexpr unsigned NotifierRaised{1u << 31};
+static std::atomic_uint PendingCallbacks{0};
+static CallbackNotifier *Notifier{nullptr};
 static char JoinGameSecret[256];
 static char SpectateGameSecret[256];
 static int LastErrorCode{0};
 static char LastErrorMessage[256];
 static int LastDisconnectErrorCode{0};
 static char LastDisconnectErrorMessage[256];
-static std::mutex PresenceMutex;
+// Which of the events we parse have a handler, see WantsFrame().
+constexpr unsigned ErrorEvent{1 << 0};
+constexpr unsigned JoinGameEvent{1 << 1};
+constexpr unsigned SpectateGameEvent{1 << 2};
+constexpr unsigned JoinRequestEvent{1 << 3};
+static std::atomic_uint HandledEvents{0};
 static std::mutex HandlerMutex;
-static QueuedMessage QueuedPresence{};
-static MsgQueue<QueuedMessage, MessageQueueSize> SendQueue;
+// Discord_UpdatePresence serializes into a free buffer and publishes it, the
+// io thread takes the newest one. SentPresence is the last one it took (io
+// thread only), kept to send again after a reconnect.
+static TripleBuffer<QueuedMessage> PresenceBuffers;
+static QueuedMessage *SentPresence{nullptr};
+static bool PresencePending{false};
+// Discord only takes about five SET_ACTIVITY per 20 seconds. Two at once and
+// then one every five seconds stays under that in any 20 second window; an
+// update that has to wait gets replaced by whatever is newer by then.
+static std::atomic_int PresenceBurst{2};
+static std::atomic_int PresenceIntervalMs{5000};
+static TokenBucket PresenceLimit(PresenceBurst.load(), std::chrono::milliseconds{PresenceIntervalMs.load()}, std::chrono::steady_clock::now());
+static std::atomic_uint64_t PresenceCoalesced{0};
+// RichPresenceHash of the last presence handed to the io thread, 0 if none.
+// Concurrent callers with different presences can leave this describing the
+// one that lost; the next change puts it right.
+static std::atomic_uint64_t LastPresenceHash{0};
+static std::atomic_uint64_t PresenceSkipped{0};
+static PresenceTemplate PresenceSkeleton;
+static LatencyStats PresenceLatency;
+// Join replies and subscriptions. Someone is waiting on these, so they go
+// out ahead of presence.
+static CommandQueue<DISCORD_SEND_QUEUE_BYTES, MaxFramesPerWrite> ControlQueue;
+// Discord_SendCommand, after presence. Nothing in here is ever evicted, every
+// command that made it in gets its callback.
+static CommandQueue<DISCORD_SEND_QUEUE_BYTES, MaxFramesPerWrite> BulkQueue;
+// Whoever runs Discord_UpdateConnection empties the command queues, so it
+// must never wait for room in them.
+static thread_local bool IsSendingThread{false};
+// Everything written and not answered yet (io thread only), and how the
+// answers went.
+static PendingRequests<MaxPendingRequests> Requests;
+static LatencyStats RoundTrip[DISCORD_COMMAND_KINDS];
+static_assert(static_cast<size_t>(CommandKind::Count) == DISCORD_COMMAND_KINDS);
+static_assert(static_cast<int>(RequestResult::Disconnected) == DISCORD_RESULT_DISCONNECTED);
+static std::atomic_uint64_t RequestsErrored{0};
+static std::atomic_uint64_t RequestsUnanswered{0};
 static MsgQueue<User, JoinQueueSize> JoinAskQueue;
+// Every event, unparsed, for whoever set a raw event handler: either straight
+// from the io thread, or queued as the event name, a null and its data for
+// Discord_RunCallbacks.
+static std::atomic<DiscordRawEventCallback> RawEventHandler{nullptr};
+static std::atomic_bool RawEventsOnIoThread{false};
+static ByteQueue<RawEventQueueBytes> RawEvents;
+static std::atomic_uint64_t RawEventsDropped{0};
+// The last update ran out of budget while reading, so there may be frames
+// sitting in the receive buffer that the socket won't wake anyone up for.
+static bool ReadsLeftOver{false};
 static User connectedUser;
 
 // We want to auto connect, and retry on failure, but not as fast as possible.
 // This does expoential backoff from 0.5 seconds to 1 minute
 static Backoff ReconnectTimeMs(500, 60 * 1000);
-static auto NextConnect = std::chrono::system_clock::now();
+static auto NextConnect = std::chrono::steady_clock::now();
 static int Pid{0};
-static int Nonce{1};
+// Handed out from any thread that writes a command.
+static std::atomic_int Nonce{1};
 
 #ifndef DISCORD_DISABLE_IO_THREAD
 static void Discord_UpdateConnection(void);
+static IoPoller::Clock::time_point NextIoDeadline();
+static int CurrentIoFd();
+static bool CurrentIoWantsWrite();
 class IoThreadHolder {
 private:
   std::atomic_bool keepRunning{true};
-  std::mutex waitForIOMutex;
-  std::condition_variable waitForIOActivity;
+  IoPoller *poller{IoPoller::Create()};
   std::thread ioThread;
 
 public:
   void Start() {
     keepRunning.store(true);
     ioThread = std::thread([&]() {
-      const std::chrono::duration<int64_t, std::milli> maxWait{500LL};
       Discord_UpdateConnection();
       while (keepRunning.load()) {
-        std::unique_lock<std::mutex> lock(waitForIOMutex);
-        waitForIOActivity.wait_for(lock, maxWait);
+        poller->Watch(CurrentIoFd(), CurrentIoWantsWrite());
+        poller->Wait(NextIoDeadline());
         Discord_UpdateConnection();
       }
     });
   }
 
-  void Notify() { waitForIOActivity.notify_all(); }
+  void Notify() {
+    if (poller) {
+      poller->Signal();
+    }
+  }
 
   void Stop() {
     keepRunning.exchange(false);
@@ -110,7 +198,10 @@ public:
     }
   }
 
-  ~IoThreadHolder() { Stop(); }
+  ~IoThreadHolder() {
+    Stop();
+    IoPoller::Destroy(poller);
+  }
 };
 #else
 class IoThreadHolder {
@@ -122,126 +213,335 @@ public:
 #endif // DISCORD_DISABLE_IO_THREAD
 static IoThreadHolder *IoThread{nullptr};
 
+// Call once whatever the callback hands out is in place.
+static void QueueCallback(const unsigned callback) {
+  const unsigned before = PendingCallbacks.fetch_or(callback | NotifierRaised, std::memory_order_acq_rel);
+  if (!(before & NotifierRaised) && Notifier) {
+    Notifier->Raise();
+  }
+}
+
 static void UpdateReconnectTime() {
   NextConnect =
-      std::chrono::system_clock::now() +
+      std::chrono::steady_clock::now() +
       std::chrono::duration<int64_t, std::milli>{ReconnectTimeMs.nextDelay()};
 }
 
+// While disconnected the only thing to wake up for is the next reconnect
+// attempt; once the socket is open, incoming data or a signal does it, a
+// presence update waiting for the rate limit, or a request timing out.
+static IoPoller::Clock::time_point NextIoDeadline() {
+  if (Connection && Connection->state == RpcConnection::State::Disconnected) {
+    return NextConnect;
+  }
+  auto deadline = IoPoller::Clock::time_point::max();
+  const auto oldestRequest = Requests.OldestSent();
+  if (oldestRequest != IoPoller::Clock::time_point::max()) {
+    deadline = oldestRequest + RequestTimeout;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (PresencePending && !PresenceLimit.ready(now)) {
+    deadline = std::min(deadline, PresenceLimit.nextReady(now));
+  }
+  return deadline;
+}
+
+static int CurrentIoFd() {
+  if (!Connection || Connection->state == RpcConnection::State::Disconnected) {
+    return -1;
+  }
+  return Connection->connection->PollFd();
+}
+
+// only while the socket didn't take everything we wrote
+static bool CurrentIoWantsWrite() {
+  return Connection && Connection->PendingWriteBytes() != 0;
+}
+
 #ifdef DISCORD_DISABLE_IO_THREAD
-extern "C" DISCORD_EXPORT void Discord_UpdateConnection(void)
-#else
-static void Discord_UpdateConnection(void)
+// Whether Discord_UpdateConnection has something new to write. A presence
+// update waiting for the rate limit doesn't count, NextIoDeadline() covers
+// that.
+static bool HaveWritesWaiting() {
+  if (!Connection || !Connection->IsOpen()) {
+    return false;
+  }
+  return ControlQueue.HavePendingSends() || BulkQueue.HavePendingSends() || PresenceBuffers.HasPublished() ||
+         (PresencePending && PresenceLimit.ready(std::chrono::steady_clock::now()));
+}
 #endif
-{
+
+static void FinishRequest(const decltype(Requests)::Entry &request, const RequestResult result, const std::string_view response) {
+  switch (result) {
+  case RequestResult::Ok:
+    RoundTrip[static_cast<size_t>(request.info.kind)].record(std::chrono::steady_clock::now() - request.sentAt);
+    break;
+  case RequestResult::Error:
+    RequestsErrored.fetch_add(1, std::memory_order_relaxed);
+    break;
+  case RequestResult::TimedOut:
+  case RequestResult::Disconnected:
+    RequestsUnanswered.fetch_add(1, std::memory_order_relaxed);
+    break;
+  }
+  if (request.info.callback) {
+    request.info.callback(request.info.userdata, static_cast<int>(result), response.empty() ? nullptr : response.data(),
+                          static_cast<uint32_t>(response.size()));
+  }
+}
+
+// A reply came in; nothing happens if it isn't one we're waiting for.
+static void CompleteRequest(const int nonce, const bool isError, const std::string_view response) {
+  decltype(Requests)::Entry request;
+  if (Requests.Take(nonce, request)) {
+    FinishRequest(request, isError ? RequestResult::Error : RequestResult::Ok, response);
+  }
+}
+
+static void TrackRequest(const RequestInfo &info) {
+  decltype(Requests)::Entry evicted;
+  if (Requests.Insert(info, std::chrono::steady_clock::now(), evicted)) {
+    FinishRequest(evicted, RequestResult::TimedOut, {});
+  }
+}
+
+// Hands the queued raw events to handler, or just drops them without one.
+// Returns whether the budget ran out before the queue did.
+static bool DeliverRawEvents(const DiscordRawEventCallback handler, CallBudget &budget) {
+  size_t position = RawEvents.BeginSend();
+  std::string_view event;
+  while (!budget.exhausted() && RawEvents.PeekSend(position, event)) {
+    if (handler) {
+      const size_t evtLength = std::strlen(event.data());
+      const std::string_view data = event.substr(evtLength + 1);
+      handler(event.data(), data.data(), static_cast<uint32_t>(data.size()));
+    }
+    budget.spend();
+  }
+  RawEvents.EndSend(position);
+  return RawEvents.HavePendingSends();
+}
+
+// Every message read and frame written counts against the budget. Returns
+// whether it stopped with some of either left over; calling again picks up
+// right there.
+static bool UpdateConnection(CallBudget &budget) {
   if (!Connection) {
-    return;
+    return false;
   }
+  IsSendingThread = true;
 
   if (!Connection->IsOpen()) {
-    if (std::chrono::system_clock::now() >= NextConnect) {
+    ReadsLeftOver = false;
+    if (Connection->state != RpcConnection::State::Disconnected) {
+      // READY is what woke us up
+      Connection->Open();
+    } else if (std::chrono::steady_clock::now() >= NextConnect) {
       UpdateReconnectTime();
       Connection->Open();
     }
   } else {
     // reads
+    bool readsLeft = false;
 
     for (;;) {
-      glz::json_t message;
+      RpcMessage message;
 
-      if (!Connection->Read(message)) {
+      if (!Connection->Read(message, budget)) {
+        // frames may be left behind the ones that used up the budget, unless
+        // the last of them closed the pipe
+        readsLeft = budget.exhausted() && Connection->IsOpen();
         break;
       }
 
-      std::string evtName;
-      if (!message["evt"].is_null()) {
-        evtName = message["evt"].get<std::string>();
-      }
-      std::string nonce;
-      if (!message["nonce"].is_null()) {
-        nonce = std::to_string(message["nonce"].as<std::int32_t>());
-      }
-
-      if (!nonce.empty()) {
-        // in responses only -- should use to match up response when needed.
+      if (message.hasNonce) {
+        // in responses only
+        CompleteRequest(message.nonce, message.evt == "ERROR", message.data);
 
-        if (!evtName.empty() && strcmp(evtName.c_str(), "ERROR") == 0) {
-          LastErrorCode = message["data"]["code"].as<std::int32_t>();
-          StringCopy(LastErrorMessage, message["data"]["message"].get_string().c_str());
-          GotErrorMessage.store(true);
+        if (message.evt == "ERROR") {
+          ErrorData error;
+          if (JsonReadData(message.data, error)) {
+            LastErrorCode = error.code;
+            JsonStringCopy(LastErrorMessage, error.message);
+            QueueCallback(ErrorCallback);
+          }
         }
       } else {
         // should have evt == name of event, optional data
-        if (evtName.empty()) {
+        if (message.evt.empty()) {
           continue;
         }
 
-        if (strcmp(evtName.c_str(), "ACTIVITY_JOIN") == 0) {
-          if (!message["data"]["secret"].is_null()) {
-            StringCopy(JoinGameSecret, message["data"]["secret"].get_string().c_str());
-            WasJoinGame.store(true);
-          }
-        } else if (strcmp(evtName.c_str(), "ACTIVITY_SPECTATE") == 0) {
-          if (!message["data"]["secret"].is_null()) {
-            StringCopy(SpectateGameSecret, message["data"]["secret"].get_string().c_str());
-            WasSpectateGame.store(true);
-          }
-        } else if (strcmp(evtName.c_str(), "ACTIVITY_JOIN_REQUEST") == 0) {
-          std::string userId;
-          if (!message["data"]["user"]["id"].is_null()) {
-            userId = message["data"]["user"]["id"].get_string();
+        if (const auto rawEvent = RawEventHandler.load(std::memory_order_acquire)) {
+          char evtName[128];
+          const size_t evtLength = JsonStringCopy(evtName, message.evt);
+          if (RawEventsOnIoThread.load(std::memory_order_relaxed)) {
+            rawEvent(evtName, message.data.data(), static_cast<uint32_t>(message.data.size()));
+          } else {
+            const std::string_view parts[]{{evtName, evtLength + 1}, message.data};
+            if (RawEvents.Add(parts, false) == decltype(RawEvents)::AddResult::Full) {
+              RawEventsDropped.fetch_add(1, std::memory_order_relaxed);
+            } else {
+              QueueCallback(RawEventCallback);
+            }
           }
-          std::string username;
-          if (!message["data"]["user"]["username"].is_null()) {
-            username = message["data"]["user"]["username"].get_string();
+        }
+
+        if (message.evt == "ACTIVITY_JOIN") {
+          SecretEventData join;
+          if (JsonReadData(message.data, join) && !join.secret.empty()) {
+            JsonStringCopy(JoinGameSecret, join.secret);
+            QueueCallback(JoinGameCallback);
           }
-          std::string avatar;
-          if (!message["data"]["user"]["avatar"].is_null()) {
-            avatar = message["data"]["user"]["avatar"].get_string();
+        } else if (message.evt == "ACTIVITY_SPECTATE") {
+          SecretEventData spectate;
+          if (JsonReadData(message.data, spectate) && !spectate.secret.empty()) {
+            JsonStringCopy(SpectateGameSecret, spectate.secret);
+            QueueCallback(SpectateGameCallback);
           }
-          auto joinReq = JoinAskQueue.GetNextAddMessage();
-          if (!userId.empty() && !username.empty() && joinReq) {
-            StringCopy(joinReq->userId, userId.c_str());
-            StringCopy(joinReq->username, username.c_str());
-            std::string discriminator;
-            if (!message["data"]["user"]["discriminator"].is_null()) {
-              discriminator = message["data"]["user"]["discriminator"].get_string();
-            }
-            if (!discriminator.empty()) {
-              StringCopy(joinReq->discriminator, discriminator.c_str());
-            }
-            if (!avatar.empty()) {
-              StringCopy(joinReq->avatar, avatar.c_str());
-            } else {
-              joinReq->avatar[0] = 0;
+        } else if (message.evt == "ACTIVITY_JOIN_REQUEST") {
+          UserEventData request;
+          if (JsonReadData(message.data, request) && HasUser(request.user)) {
+            auto joinReq = JoinAskQueue.GetNextAddMessage();
+            if (joinReq) {
+              CopyUser(*joinReq, request.user);
+              JoinAskQueue.CommitAdd();
+              QueueCallback(JoinRequestCallback);
             }
-            JoinAskQueue.CommitAdd();
           }
         }
       }
     }
 
+    ReadsLeftOver = readsLeft;
+
+    Requests.Expire(std::chrono::steady_clock::now() - RequestTimeout, [](const auto &request) {
+      FinishRequest(request, RequestResult::TimedOut, {});
+    });
+
     // writes
-    if (UpdatePresence.exchange(false) && QueuedPresence.length) {
-      QueuedMessage local;
-      {
-        std::lock_guard guard(PresenceMutex);
-        local.Copy(QueuedPresence);
+    if (!Connection->Flush()) {
+      return false;
+    }
+
+    // Everything waiting goes out in gather writes, straight from where it
+    // was queued: control commands first, then presence, then the rest.
+    IoSlice frames[MaxFramesPerWrite];
+    RequestInfo sent[MaxFramesPerWrite];
+
+    if (auto latest = PresenceBuffers.TakeLatest()) {
+      if (SentPresence) {
+        if (PresencePending) {
+          PresenceCoalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+        PresenceBuffers.Release(SentPresence);
       }
-      if (!Connection->Write(local.buffer, local.length)) {
-        // if we fail to send, requeue
-        std::lock_guard guard(PresenceMutex);
-        QueuedPresence.Copy(local);
-        UpdatePresence.exchange(true);
+      SentPresence = latest;
+      PresencePending = latest->length > 0;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    PresenceLimit.configure(PresenceBurst.load(), std::chrono::milliseconds{PresenceIntervalMs.load()}, now);
+    bool sendPresence = PresencePending && PresenceLimit.ready(now);
+
+    // one write always goes out, or a steady stream of reads could use up
+    // every budget and starve them
+    for (bool first = true;; first = false) {
+      if (!first && budget.exhausted()) {
+        return true;
+      }
+      const size_t controlCount = ControlQueue.BeginSend(frames, sent, MaxFramesPerWrite);
+      size_t frameCount = controlCount;
+      const bool withPresence = sendPresence && frameCount < MaxFramesPerWrite;
+      if (withPresence) {
+        sent[frameCount] = {SentPresence->nonce, CommandKind::SetActivity};
+        frames[frameCount++] = {SentPresence->buffer, SentPresence->length};
+      }
+      const size_t bulkStart = frameCount;
+      frameCount += BulkQueue.BeginSend(frames + frameCount, sent + frameCount, MaxFramesPerWrite - frameCount);
+
+      const size_t taken = frameCount ? Connection->WriteFrames(RpcConnection::Opcode::Frame, frames, frameCount) : 0;
+      const bool tookAll = taken == frameCount;
+      ControlQueue.EndSend(std::min(taken, controlCount));
+      BulkQueue.EndSend(taken > bulkStart ? taken - bulkStart : 0);
+      for (size_t i = 0; i < taken; ++i) {
+        TrackRequest(sent[i]);
+      }
+      budget.spend(static_cast<uint32_t>(taken));
+
+      // if it didn't fit, it stays pending unless a newer one shows up
+      if (withPresence && taken > controlCount) {
+        sendPresence = false;
+        PresencePending = false;
+        PresenceLimit.take();
+        PresenceLatency.record(std::chrono::steady_clock::now() - SentPresence->queuedAt);
+      }
+
+      if (!frameCount || !tookAll ||
+          (!sendPresence && !ControlQueue.HavePendingSends() && !BulkQueue.HavePendingSends())) {
+        break;
       }
     }
+    // a failed write closes the connection, which clears it
+    return ReadsLeftOver;
+  }
+  return false;
+}
 
-    while (SendQueue.HavePendingSends()) {
-      auto qmessage = SendQueue.GetNextSendMessage();
-      Connection->Write(qmessage->buffer, qmessage->length);
-      SendQueue.CommitSend();
+#ifdef DISCORD_DISABLE_IO_THREAD
+extern "C" DISCORD_EXPORT void Discord_UpdateConnection(void)
+#else
+static void Discord_UpdateConnection(void)
+#endif
+{
+  auto budget = CallBudget::unlimited();
+  UpdateConnection(budget);
+}
+
+#ifdef DISCORD_DISABLE_IO_THREAD
+extern "C" DISCORD_EXPORT int
+Discord_UpdateConnectionBudgeted(uint32_t maxMicros, uint32_t maxMessages, uint32_t *elapsedMicros) {
+  CallBudget budget(maxMicros, maxMessages);
+  const bool more = UpdateConnection(budget);
+  if (elapsedMicros) {
+    *elapsedMicros = budget.elapsedMicros();
+  }
+  return more ? 1 : 0;
+}
+#endif
+
+static unsigned HandledEventsFor(const DiscordEventHandlers &handlers) {
+  return (handlers.errored ? ErrorEvent : 0u) |
+         (handlers.joinGame ? JoinGameEvent : 0u) |
+         (handlers.spectateGame ? SpectateGameEvent : 0u) |
+         (handlers.joinRequest ? JoinRequestEvent : 0u);
+}
+
+// Called by the connection with the evt and nonce it peeked at, before the
+// frame gets parsed. Anything Discord_UpdateConnection would throw away
+// anyway is dropped right there; a reply nobody needs to read still
+// completes its request.
+static bool WantsFrame(std::string_view evt, bool hasNonce, int nonce) {
+  const unsigned handled = HandledEvents.load(std::memory_order_relaxed);
+  if (hasNonce) {
+    if ((evt == "ERROR" && (handled & ErrorEvent)) || Requests.WantsResponse(nonce)) {
+      return true;
     }
+    CompleteRequest(nonce, evt == "ERROR", {});
+    return false;
+  }
+  if (RawEventHandler.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  if (evt == "ACTIVITY_JOIN") {
+    return handled & JoinGameEvent;
   }
+  if (evt == "ACTIVITY_SPECTATE") {
+    return handled & SpectateGameEvent;
+  }
+  if (evt == "ACTIVITY_JOIN_REQUEST") {
+    return handled & JoinRequestEvent;
+  }
+  return false;
 }
 
 static void SignalIOActivity() {
@@ -250,27 +550,47 @@ static void SignalIOActivity() {
   }
 }
 
-static bool RegisterForEvent(const char *evtName) {
-  auto qmessage = SendQueue.GetNextAddMessage();
-  if (qmessage) {
-    qmessage->length = JsonWriteSubscribeCommand(
-        qmessage->buffer, sizeof(qmessage->buffer), Nonce++, evtName);
-    SendQueue.CommitAdd();
+// Wakes the io thread if the command made it into a queue.
+static int SendResult(const decltype(ControlQueue)::Result result) {
+  using Result = decltype(ControlQueue)::Result;
+  switch (result) {
+  case Result::Queued:
     SignalIOActivity();
-    return true;
+    return DISCORD_SEND_QUEUED;
+  case Result::QueuedAfterEvicting:
+    SignalIOActivity();
+    return DISCORD_SEND_QUEUED_EVICTED;
+  case Result::TimedOut:
+    return DISCORD_SEND_TIMED_OUT;
+  case Result::Dropped:
+    break;
   }
-  return false;
+  return DISCORD_SEND_DROPPED;
 }
 
-static bool DeregisterForEvent(const char *evtName) {
-  auto qmessage = SendQueue.GetNextAddMessage();
-  if (qmessage) {
-    qmessage->length = JsonWriteUnsubscribeCommand(qmessage->buffer, sizeof(qmessage->buffer), Nonce++, evtName);
-    SendQueue.CommitAdd();
-    SignalIOActivity();
-    return true;
+// Written out on the stack first, so the queue only has to find room for
+// what the command really takes. Safe from any thread; returns one of the
+// DISCORD_SEND_* results.
+template <typename Writer> static int QueueCommand(const CommandKind kind, Writer write) {
+  char command[MaxCommandSize];
+  const RequestInfo info{Nonce++, kind};
+  const size_t length = write(command, sizeof(command), info.nonce);
+  if (!length) {
+    return DISCORD_SEND_INVALID;
   }
-  return false;
+  return SendResult(ControlQueue.Add(info, command, length, !IsSendingThread));
+}
+
+static int RegisterForEvent(const char *evtName) {
+  return QueueCommand(CommandKind::Subscribe, [&](char *dest, size_t maxLen, int nonce) {
+    return JsonWriteSubscribeCommand(dest, maxLen, nonce, evtName);
+  });
+}
+
+static int DeregisterForEvent(const char *evtName) {
+  return QueueCommand(CommandKind::Unsubscribe, [&](char *dest, size_t maxLen, int nonce) {
+    return JsonWriteUnsubscribeCommand(dest, maxLen, nonce, evtName);
+  });
 }
 
 extern "C" DISCORD_EXPORT void
@@ -289,6 +609,9 @@ Discord_Initialize(const char *applicationId, const DiscordEventHandlers *handle
   }
 
   Pid = GetProcessId();
+  if (!Notifier) {
+    Notifier = CallbackNotifier::Create();
+  }
 
   {
     std::lock_guard guard(HandlerMutex);
@@ -300,6 +623,7 @@ Discord_Initialize(const char *applicationId, const DiscordEventHandlers *handle
     }
 
     Handlers = {};
+    HandledEvents.store(0);
   }
 
   if (Connection) {
@@ -307,49 +631,32 @@ Discord_Initialize(const char *applicationId, const DiscordEventHandlers *handle
   }
 
   Connection = RpcConnection::Create(applicationId);
-  Connection->onConnect = [](glz::json_t& readyMessage) {
+  Connection->onConnect = [](const RpcMessage &readyMessage) {
     Discord_UpdateHandlers(&QueuedHandlers);
-    if (QueuedPresence.length > 0) {
-      UpdatePresence.exchange(true);
+    if (SentPresence && SentPresence->length > 0) {
+      SentPresence->queuedAt = std::chrono::steady_clock::now();
+      PresencePending = true;
       SignalIOActivity();
     }
 
-    std::string userId;
-    if (!readyMessage["data"]["user"]["id"].is_null()) {
-      userId = readyMessage["data"]["user"]["id"].get_string();
-    }
-    std::string username;
-    if (!readyMessage["data"]["user"]["username"].is_null()) {
-      username = readyMessage["data"]["user"]["username"].get_string();
-    }
-    std::string avatar;
-    if (!readyMessage["data"]["user"]["avatar"].is_null()) {
-      avatar = readyMessage["data"]["user"]["avatar"].get_string();
+    UserEventData ready;
+    if (JsonReadData(readyMessage.data, ready) && HasUser(ready.user)) {
+      CopyUser(connectedUser, ready.user);
     }
-    if (!userId.empty() && !username.empty()) {
-      StringCopy(connectedUser.userId, userId.c_str());
-      StringCopy(connectedUser.username, username.c_str());
-      std::string discriminator;
-      if (!readyMessage["data"]["user"]["discriminator"].is_null()) {
-        discriminator = readyMessage["data"]["user"]["discriminator"].get_string();
-      }
-      if (!discriminator.empty()) {
-        StringCopy(connectedUser.discriminator, discriminator.c_str());
-      }
-      if (!avatar.empty()) {
-        StringCopy(connectedUser.avatar, avatar.c_str());
-      } else {
-        connectedUser.avatar[0] = 0;
-      }
-    }
-    WasJustConnected.exchange(true);
+    QueueCallback(ConnectedCallback);
     ReconnectTimeMs.reset();
   };
 
+  Connection->wantsFrame = WantsFrame;
+
   Connection->onDisconnect = [](const int err, const char *message) {
+    Requests.Clear([](const auto &request) {
+      FinishRequest(request, RequestResult::Disconnected, {});
+    });
+    ReadsLeftOver = false;
     LastDisconnectErrorCode = err;
     StringCopy(LastDisconnectErrorMessage, message);
-    WasJustDisconnected.exchange(true);
+    QueueCallback(DisconnectedCallback);
     UpdateReconnectTime();
   };
 
@@ -363,25 +670,97 @@ extern "C" DISCORD_EXPORT void Discord_Shutdown(void) {
 
   Connection->onConnect = nullptr;
   Connection->onDisconnect = nullptr;
+  Connection->wantsFrame = nullptr;
   Handlers = {};
-  QueuedPresence.length = 0;
-  UpdatePresence.exchange(false);
+  HandledEvents.store(0);
   if (IoThread != nullptr) {
     IoThread->Stop();
     delete IoThread;
     IoThread = nullptr;
   }
+  Requests.Clear([](const auto &request) {
+    FinishRequest(request, RequestResult::Disconnected, {});
+  });
+  // Whatever never got written is answered too, so nothing queued outlives
+  // this connection and its userdata.
+  const auto unsent = [](const RequestInfo &info) {
+    FinishRequest({info, std::chrono::steady_clock::now()}, RequestResult::Disconnected, {});
+  };
+  ControlQueue.Clear(unsent);
+  BulkQueue.Clear(unsent);
+  while (JoinAskQueue.HavePendingSends()) {
+    JoinAskQueue.GetNextSendMessage();
+    JoinAskQueue.CommitSend();
+  }
+  auto budget = CallBudget::unlimited();
+  DeliverRawEvents(nullptr, budget);
+  PendingCallbacks.store(0);
+  CallbackNotifier::Destroy(Notifier);
+  PresenceBuffers.Reset();
+  LastPresenceHash.store(0);
+  PresenceSkeleton = {};
+  SentPresence = nullptr;
+  PresencePending = false;
+  ReadsLeftOver = false;
 
   RpcConnection::Destroy(Connection);
 }
 
+// Games tend to update presence every frame; same content means nothing to
+// do, not even serializing it.
+static QueuedMessage *BeginPresence(const uint64_t hash) {
+  if (LastPresenceHash.exchange(hash) == hash) {
+    PresenceSkipped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  QueuedMessage *qmessage = PresenceBuffers.BeginWrite();
+  qmessage->nonce = Nonce++;
+  return qmessage;
+}
+
+static void CommitPresence(QueuedMessage *qmessage) {
+  qmessage->queuedAt = std::chrono::steady_clock::now();
+  if (PresenceBuffers.Publish(qmessage)) {
+    PresenceCoalesced.fetch_add(1, std::memory_order_relaxed);
+  }
+  SignalIOActivity();
+}
+
 extern "C" DISCORD_EXPORT void
 Discord_UpdatePresence(const DiscordRichPresence *presence) {
-  {
-    std::lock_guard guard(PresenceMutex);
-    QueuedPresence.length = JsonWriteRichPresenceObj(QueuedPresence.buffer, sizeof(QueuedPresence.buffer), Nonce++, Pid, presence);
-    UpdatePresence.exchange(true);
+  if (auto qmessage = BeginPresence(RichPresenceHash(presence))) {
+    qmessage->length = JsonWriteRichPresenceObj(qmessage->buffer, sizeof(qmessage->buffer), qmessage->nonce, Pid, presence);
+    CommitPresence(qmessage);
+  }
+}
+
+extern "C" DISCORD_EXPORT void
+Discord_UpdatePresenceEx(const DiscordRichPresenceEx *presence) {
+  if (auto qmessage = BeginPresence(RichPresenceHash(presence))) {
+    qmessage->length = JsonWriteRichPresenceObj(qmessage->buffer, sizeof(qmessage->buffer), qmessage->nonce, Pid, presence);
+    CommitPresence(qmessage);
+  }
+}
+
+extern "C" DISCORD_EXPORT int
+Discord_SetPresenceTemplate(const DiscordRichPresence *presence, int openFields) {
+  return JsonCompilePresenceTemplate(PresenceSkeleton, Pid, presence, openFields) ? 1 : 0;
+}
+
+extern "C" DISCORD_EXPORT void
+Discord_UpdatePresenceFields(const DiscordPresenceFields *fields) {
+  if (!PresenceSkeleton.holeCount) {
+    return;
+  }
+  if (auto qmessage = BeginPresence(PresenceFieldsHash(PresenceSkeleton, fields))) {
+    qmessage->length = JsonWritePresenceFromTemplate(qmessage->buffer, sizeof(qmessage->buffer), PresenceSkeleton, qmessage->nonce, fields);
+    CommitPresence(qmessage);
   }
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetPresenceRateLimit(int burst, int intervalMs) {
+  PresenceBurst.store(burst);
+  PresenceIntervalMs.store(intervalMs);
   SignalIOActivity();
 }
 
@@ -389,44 +768,155 @@ extern "C" DISCORD_EXPORT void Discord_ClearPresence(void) {
   Discord_UpdatePresence(nullptr);
 }
 
-extern "C" DISCORD_EXPORT void Discord_Respond(const char *userId, /* DISCORD_REPLY_ */ int reply) {
+extern "C" DISCORD_EXPORT int Discord_Respond(const char *userId, /* DISCORD_REPLY_ */ int reply) {
   // if we are not connected, let's not batch up stale messages for later
   if (!Connection || !Connection->IsOpen()) {
+    return DISCORD_SEND_NOT_CONNECTED;
+  }
+
+  return QueueCommand(CommandKind::JoinReply, [&](char *dest, size_t maxLen, int nonce) {
+    return JsonWriteJoinReply(dest, maxLen, userId, reply, nonce);
+  });
+}
+
+// The args go into the queue straight from the caller, between the head and
+// the closing brace; nothing is parsed.
+extern "C" DISCORD_EXPORT int Discord_SendCommand(const char *cmd,
+                                                  const char *argsJson,
+                                                  uint32_t argsLength,
+                                                  DiscordCommandCallback callback,
+                                                  void *userdata) {
+  if (!Connection || !Connection->IsOpen()) {
+    return DISCORD_SEND_NOT_CONNECTED;
+  }
+  if (!cmd) {
+    return DISCORD_SEND_INVALID;
+  }
+
+  const RequestInfo info{Nonce++, CommandKind::Other, callback, userdata};
+  char head[MaxCommandSize];
+  const size_t headLength = JsonWriteCommandHead(head, sizeof(head), info.nonce, cmd);
+  if (!headLength) {
+    return DISCORD_SEND_INVALID;
+  }
+  const std::string_view parts[]{
+      {head, headLength},
+      argsJson && argsLength ? std::string_view{argsJson, argsLength} : std::string_view{"{}"},
+      "}",
+  };
+  return SendResult(BulkQueue.Add(info, parts, !IsSendingThread));
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetSendQueuePolicy(int policy, int limit) {
+  using Policy = decltype(ControlQueue)::Policy;
+  switch (policy) {
+  case DISCORD_QUEUE_DROP_OLDEST:
+    ControlQueue.SetPolicy(Policy::DropOldest, limit);
+    // evicting would lose callbacks
+    BulkQueue.SetPolicy(Policy::DropNewest, limit);
+    break;
+  case DISCORD_QUEUE_BLOCK:
+    ControlQueue.SetPolicy(Policy::Block, limit);
+    BulkQueue.SetPolicy(Policy::Block, limit);
+    break;
+  case DISCORD_QUEUE_GROW:
+    ControlQueue.SetPolicy(Policy::Grow, limit);
+    BulkQueue.SetPolicy(Policy::Grow, limit);
+    break;
+  default:
+    ControlQueue.SetPolicy(Policy::DropNewest, limit);
+    BulkQueue.SetPolicy(Policy::DropNewest, limit);
+    break;
+  }
+}
+
+#ifdef DISCORD_DISABLE_IO_THREAD
+// What the io thread would wait for, for a host that runs its own loop.
+extern "C" DISCORD_EXPORT void Discord_GetIoInterest(DiscordIoInterest *interest) {
+  if (!interest) {
+    return;
+  }
+  *interest = {-1, 0, 0, -1};
+  if (!Connection) {
     return;
   }
 
-  const auto qmessage = SendQueue.GetNextAddMessage();
-  if (qmessage) {
-    qmessage->length = JsonWriteJoinReply(
-        qmessage->buffer, sizeof(qmessage->buffer), userId, reply, Nonce++);
-    SendQueue.CommitAdd();
-    SignalIOActivity();
+  interest->fd = CurrentIoFd();
+  interest->wantRead = interest->fd != -1;
+  interest->wantWrite = CurrentIoWantsWrite() || HaveWritesWaiting();
+
+  const auto now = std::chrono::steady_clock::now();
+  auto deadline = NextIoDeadline();
+  if (interest->fd == -1 && Connection->state != RpcConnection::State::Disconnected) {
+    // no descriptor for the pipe (Windows), look at it every so often
+    deadline = std::min(deadline, now + std::chrono::milliseconds{500});
+  }
+  if ((interest->wantWrite && interest->fd == -1) || (ReadsLeftOver && Connection->IsOpen())) {
+    deadline = now;
+  }
+  if (deadline != IoPoller::Clock::time_point::max()) {
+    const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+    interest->timeoutMs = static_cast<int>(std::clamp<int64_t>(left, 0, INT32_MAX));
   }
 }
+#endif
 
-extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void) {
+extern "C" DISCORD_EXPORT int Discord_GetCallbackFd(void) {
+  return Notifier ? Notifier->Fd() : -1;
+}
+
+extern "C" DISCORD_EXPORT void
+Discord_SetRawEventHandler(DiscordRawEventCallback handler, int delivery) {
+  RawEventsOnIoThread.store(delivery == DISCORD_RAW_EVENTS_IO_THREAD, std::memory_order_relaxed);
+  RawEventHandler.store(handler, std::memory_order_release);
+}
+
+// Every callback counts against the budget, each raw event and join request
+// on its own. The ones it doesn't get to are queued again, so returning true
+// means there's more and the notifier is raised for it.
+static bool RunCallbacks(CallBudget &budget) {
   // Note on some weirdness: internally we might connect, get other signals,
   // disconnect any number of times inbetween calls here. Externally, we want
   // the sequence to seem sane, so any other signals are book-ended by calls to
   // ready and disconnect.
 
   if (!Connection) {
-    return;
+    return false;
   }
 
-  const bool wasDisconnected = WasJustDisconnected.exchange(false);
+  unsigned pending = PendingCallbacks.load(std::memory_order_relaxed);
+  if (!pending) {
+    return false;
+  }
+  // Cleared before taking the bits: anything queued from here on either
+  // lands in this call or raises the notifier again.
+  if ((pending & NotifierRaised) && Notifier) {
+    Notifier->Clear();
+  }
+  pending = PendingCallbacks.exchange(0, std::memory_order_acquire);
+
+  unsigned left = pending & ~NotifierRaised;
+  const auto due = [&](const unsigned callback) {
+    if (!(left & callback) || budget.exhausted()) {
+      return false;
+    }
+    left &= ~callback;
+    budget.spend();
+    return true;
+  };
+
   const bool isConnected = Connection->IsOpen();
 
-  if (isConnected) {
+  if (isConnected && due(DisconnectedCallback)) {
     // if we are connected, disconnect cb first
     std::lock_guard guard(HandlerMutex);
-    if (wasDisconnected && Handlers.disconnected) {
+    if (Handlers.disconnected) {
       Handlers.disconnected(LastDisconnectErrorCode,
                             LastDisconnectErrorMessage);
     }
   }
 
-  if (WasJustConnected.exchange(false)) {
+  if (due(ConnectedCallback)) {
     std::lock_guard guard(HandlerMutex);
     if (Handlers.ready) {
       const DiscordUser du{connectedUser.userId, connectedUser.username, connectedUser.discriminator, connectedUser.avatar};
@@ -434,21 +924,21 @@ extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void) {
     }
   }
 
-  if (GotErrorMessage.exchange(false)) {
+  if (due(ErrorCallback)) {
     std::lock_guard guard(HandlerMutex);
     if (Handlers.errored) {
       Handlers.errored(LastErrorCode, LastErrorMessage);
     }
   }
 
-  if (WasJoinGame.exchange(false)) {
+  if (due(JoinGameCallback)) {
     std::lock_guard guard(HandlerMutex);
     if (Handlers.joinGame) {
       Handlers.joinGame(JoinGameSecret);
     }
   }
 
-  if (WasSpectateGame.exchange(false)) {
+  if (due(SpectateGameCallback)) {
     std::lock_guard guard(HandlerMutex);
     if (Handlers.spectateGame) {
       Handlers.spectateGame(SpectateGameSecret);
@@ -462,7 +952,12 @@ extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void) {
   // them in one common dialog and/or start fetching the avatars in parallel,
   // and if not it should be trivial for the implementer to make a queue
   // themselves.
+  left &= ~JoinRequestCallback;
   while (JoinAskQueue.HavePendingSends()) {
+    if (budget.exhausted()) {
+      left |= JoinRequestCallback;
+      break;
+    }
     auto req = JoinAskQueue.GetNextSendMessage();
     {
       std::lock_guard guard(HandlerMutex);
@@ -473,38 +968,124 @@ extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void) {
       }
     }
     JoinAskQueue.CommitSend();
+    budget.spend();
+  }
+
+  if (left & RawEventCallback) {
+    left &= ~RawEventCallback;
+    if (DeliverRawEvents(RawEventHandler.load(std::memory_order_acquire), budget)) {
+      left |= RawEventCallback;
+    }
   }
 
-  if (!isConnected) {
+  if (!isConnected && due(DisconnectedCallback)) {
     // if we are not connected, disconnect message last
     std::lock_guard guard(HandlerMutex);
-    if (wasDisconnected && Handlers.disconnected) {
+    if (Handlers.disconnected) {
       Handlers.disconnected(LastDisconnectErrorCode,
                             LastDisconnectErrorMessage);
     }
   }
+
+  if (left) {
+    QueueCallback(left);
+  }
+  return left != 0;
+}
+
+extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void) {
+  auto budget = CallBudget::unlimited();
+  RunCallbacks(budget);
+}
+
+extern "C" DISCORD_EXPORT int
+Discord_RunCallbacksBudgeted(uint32_t maxMicros, uint32_t maxCallbacks, uint32_t *elapsedMicros) {
+  CallBudget budget(maxMicros, maxCallbacks);
+  const bool more = RunCallbacks(budget);
+  if (elapsedMicros) {
+    *elapsedMicros = budget.elapsedMicros();
+  }
+  return more ? 1 : 0;
 }
 
 extern "C" DISCORD_EXPORT void
 Discord_UpdateHandlers(DiscordEventHandlers *newHandlers) {
   if (newHandlers) {
+    // Queued once the lock is released: a full queue can make us wait, and
+    // the io thread needs the lock before it can drain anything.
+    struct {
+      const char *event;
+      bool subscribe;
+    } changes[3];
+    size_t changeCount = 0;
+
 #define HANDLE_EVENT_REGISTRATION(handler_name, event)                         \
   if (!Handlers.handler_name && newHandlers->handler_name) {                   \
-    RegisterForEvent(event);                                                   \
+    changes[changeCount++] = {event, true};                                    \
   } else if (Handlers.handler_name && !newHandlers->handler_name) {            \
-    DeregisterForEvent(event);                                                 \
+    changes[changeCount++] = {event, false};                                   \
   }
 
-    std::lock_guard guard(HandlerMutex);
-    HANDLE_EVENT_REGISTRATION(joinGame, "ACTIVITY_JOIN")
-    HANDLE_EVENT_REGISTRATION(spectateGame, "ACTIVITY_SPECTATE")
-    HANDLE_EVENT_REGISTRATION(joinRequest, "ACTIVITY_JOIN_REQUEST")
+    {
+      std::lock_guard guard(HandlerMutex);
+      HANDLE_EVENT_REGISTRATION(joinGame, "ACTIVITY_JOIN")
+      HANDLE_EVENT_REGISTRATION(spectateGame, "ACTIVITY_SPECTATE")
+      HANDLE_EVENT_REGISTRATION(joinRequest, "ACTIVITY_JOIN_REQUEST")
+
+      Handlers = *newHandlers;
+      HandledEvents.store(HandledEventsFor(Handlers));
+    }
 
 #undef HANDLE_EVENT_REGISTRATION
 
-    Handlers = *newHandlers;
+    for (size_t i = 0; i < changeCount; ++i) {
+      if (changes[i].subscribe) {
+        RegisterForEvent(changes[i].event);
+      } else {
+        DeregisterForEvent(changes[i].event);
+      }
+    }
   } else {
     std::lock_guard guard(HandlerMutex);
     Handlers = {};
+    HandledEvents.store(0);
+  }
+}
+
+static void CopyLatency(DiscordLatencyStats &dest, const LatencyStats &src) {
+  dest.count = src.count.load();
+  dest.totalMicros = src.totalMicros.load();
+  dest.maxMicros = src.maxMicros.load();
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetStats(DiscordStats *stats) {
+  if (!stats) {
+    return;
+  }
+  *stats = {};
+  stats->presenceCoalesced = PresenceCoalesced.load();
+  stats->presenceSkipped = PresenceSkipped.load();
+  stats->stringsTruncated = JsonTruncatedStrings();
+  stats->commandsDropped = ControlQueue.Dropped() + BulkQueue.Dropped();
+  stats->commandsEvicted = ControlQueue.Evicted();
+  stats->sendQueuePeakBytes = static_cast<uint32_t>(std::max(ControlQueue.PeakBytes(), BulkQueue.PeakBytes()));
+  CopyLatency(stats->controlLatency, ControlQueue.Latency());
+  CopyLatency(stats->presenceLatency, PresenceLatency);
+  CopyLatency(stats->commandLatency, BulkQueue.Latency());
+  for (size_t i = 0; i < DISCORD_COMMAND_KINDS; ++i) {
+    CopyLatency(stats->roundTrip[i], RoundTrip[i]);
+  }
+  stats->requestsErrored = RequestsErrored.load();
+  stats->requestsUnanswered = RequestsUnanswered.load();
+  stats->rawEventsDropped = RawEventsDropped.load();
+  if (Connection) {
+    stats->lastConnectMicros = Connection->lastReadyMicros.load();
+    stats->framesFiltered = Connection->framesFiltered.load();
+    stats->writesDeferred = Connection->writesDeferred.load();
+    stats->outboundPeakBytes = Connection->outboundPeakBytes.load();
+    stats->writeCalls = Connection->writeCalls.load();
+    stats->framesWritten = Connection->framesWritten.load();
+    stats->readCalls = Connection->readCalls.load();
+    stats->framesRead = Connection->framesRead.load();
   }
 }
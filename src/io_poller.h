@@ -0,0 +1,38 @@
+#pragma once
+
+// This is to wrap the platform specific way of sleeping until the io thread
+// has something to do.
+
+#include <chrono>
+
+struct IoPoller {
+  using Clock = std::chrono::steady_clock;
+
+  static IoPoller *Create();
+  static void Destroy(IoPoller *&);
+
+  // Descriptor of the ipc connection to wait on, -1 if there is none, and
+  // whether to also wake up when it becomes writable. Calling this again with
+  // the same arguments is cheap.
+  void Watch(int fd, bool wantWrite);
+  // Wakes up Wait(), from any thread.
+  void Signal();
+  // Blocks until the watched connection is ready, Signal() was called or the
+  // deadline passed. Clock::time_point::max() means no deadline.
+  void Wait(Clock::time_point deadline);
+};
+
+// The other direction: a descriptor the host can wait on, readable while
+// Discord_RunCallbacks has something to do. Lives next to IoPoller because it
+// is built from the same pieces.
+struct CallbackNotifier {
+  static CallbackNotifier *Create();
+  static void Destroy(CallbackNotifier *&);
+
+  // -1 where there is no such descriptor (Windows).
+  int Fd();
+  // Makes Fd() readable, from any thread.
+  void Raise();
+  // Makes Fd() unreadable again.
+  void Clear();
+};
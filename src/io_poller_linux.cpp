@@ -0,0 +1,181 @@
+#include "io_poller.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+// One epoll set holds the ipc socket, an eventfd for Signal() and a timerfd
+// for the next deadline, so the io thread only wakes up when there is work.
+struct IoPollerLinux : public IoPoller {
+  int epollFd{-1};
+  int wakeFd{-1};
+  int timerFd{-1};
+  int watchedFd{-1};
+  uint32_t watchedEvents{0};
+  Clock::time_point armedDeadline{Clock::time_point::max()};
+};
+
+static IoPollerLinux Poller;
+
+static void CloseFd(int &fd) {
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+static bool AddToEpoll(int epollFd, int fd, uint32_t events = EPOLLIN, int op = EPOLL_CTL_ADD) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epollFd, op, fd, &ev) == 0;
+}
+
+static void Drain(int fd) {
+  uint64_t value;
+  while (read(fd, &value, sizeof(value)) == sizeof(value)) {
+  }
+}
+
+/*static*/ IoPoller *IoPoller::Create() {
+  Poller.epollFd = epoll_create1(EPOLL_CLOEXEC);
+  Poller.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  Poller.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  Poller.watchedFd = -1;
+  Poller.watchedEvents = 0;
+  Poller.armedDeadline = Clock::time_point::max();
+
+  if (Poller.epollFd == -1 || Poller.wakeFd == -1 || Poller.timerFd == -1 ||
+      !AddToEpoll(Poller.epollFd, Poller.wakeFd) ||
+      !AddToEpoll(Poller.epollFd, Poller.timerFd)) {
+    // Wait() falls back to sleeping without an epoll set
+    CloseFd(Poller.epollFd);
+  }
+  return &Poller;
+}
+
+/*static*/ void IoPoller::Destroy(IoPoller *&p) {
+  auto self = reinterpret_cast<IoPollerLinux *>(p);
+  CloseFd(self->epollFd);
+  CloseFd(self->wakeFd);
+  CloseFd(self->timerFd);
+  self->watchedFd = -1;
+  p = nullptr;
+}
+
+void IoPoller::Watch(int fd, bool wantWrite) {
+  auto self = reinterpret_cast<IoPollerLinux *>(this);
+  const uint32_t events = EPOLLIN | (wantWrite ? EPOLLOUT : 0u);
+  if (self->epollFd == -1 || (fd == self->watchedFd && events == self->watchedEvents)) {
+    return;
+  }
+  if (fd != -1 && fd == self->watchedFd) {
+    if (AddToEpoll(self->epollFd, fd, events, EPOLL_CTL_MOD)) {
+      self->watchedEvents = events;
+    }
+    return;
+  }
+  if (self->watchedFd != -1) {
+    // fails harmlessly if the socket was already closed
+    epoll_ctl(self->epollFd, EPOLL_CTL_DEL, self->watchedFd, nullptr);
+  }
+  self->watchedFd = -1;
+  self->watchedEvents = 0;
+  if (fd != -1 && AddToEpoll(self->epollFd, fd, events)) {
+    self->watchedFd = fd;
+    self->watchedEvents = events;
+  }
+}
+
+void IoPoller::Signal() {
+  auto self = reinterpret_cast<IoPollerLinux *>(this);
+  if (self->wakeFd == -1) {
+    return;
+  }
+  const uint64_t one = 1;
+  [[maybe_unused]] auto res = write(self->wakeFd, &one, sizeof(one));
+}
+
+static void ArmTimer(IoPollerLinux *self, IoPoller::Clock::time_point deadline) {
+  if (deadline == self->armedDeadline) {
+    return;
+  }
+  itimerspec spec{};
+  if (deadline != IoPoller::Clock::time_point::max()) {
+    // steady_clock is CLOCK_MONOTONIC; a zero it_value would disarm the timer
+    const auto ns = std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count(), 1);
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+  }
+  timerfd_settime(self->timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  self->armedDeadline = deadline;
+}
+
+void IoPoller::Wait(Clock::time_point deadline) {
+  auto self = reinterpret_cast<IoPollerLinux *>(this);
+  if (self->epollFd == -1) {
+    const auto cap = Clock::now() + std::chrono::milliseconds{500};
+    std::this_thread::sleep_until(std::min(deadline, cap));
+    return;
+  }
+
+  ArmTimer(self, deadline);
+
+  epoll_event events[3];
+  int count;
+  do {
+    count = epoll_wait(self->epollFd, events, 3, -1);
+  } while (count < 0 && errno == EINTR);
+
+  for (int i = 0; i < count; ++i) {
+    if (events[i].data.fd == self->wakeFd) {
+      Drain(self->wakeFd);
+    } else if (events[i].data.fd == self->timerFd) {
+      Drain(self->timerFd);
+      self->armedDeadline = Clock::time_point::max();
+    }
+  }
+}
+
+// An eventfd; reading it resets the count.
+struct CallbackNotifierLinux : public CallbackNotifier {
+  int fd{-1};
+};
+
+static CallbackNotifierLinux Notifier;
+
+/*static*/ CallbackNotifier *CallbackNotifier::Create() {
+  Notifier.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return &Notifier;
+}
+
+/*static*/ void CallbackNotifier::Destroy(CallbackNotifier *&p) {
+  CloseFd(reinterpret_cast<CallbackNotifierLinux *>(p)->fd);
+  p = nullptr;
+}
+
+int CallbackNotifier::Fd() { return reinterpret_cast<CallbackNotifierLinux *>(this)->fd; }
+
+void CallbackNotifier::Raise() {
+  auto self = reinterpret_cast<CallbackNotifierLinux *>(this);
+  if (self->fd == -1) {
+    return;
+  }
+  const uint64_t one = 1;
+  [[maybe_unused]] auto res = write(self->fd, &one, sizeof(one));
+}
+
+void CallbackNotifier::Clear() {
+  auto self = reinterpret_cast<CallbackNotifierLinux *>(this);
+  if (self->fd != -1) {
+    Drain(self->fd);
+  }
+}
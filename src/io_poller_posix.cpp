@@ -0,0 +1,143 @@
+#include "io_poller.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+// Without epoll we poll() the ipc socket together with the read end of a pipe
+// that Signal() writes to.
+struct IoPollerPosix : public IoPoller {
+  int wakePipe[2]{-1, -1};
+  int watchedFd{-1};
+  bool wantWrite{false};
+};
+
+static IoPollerPosix Poller;
+
+/*static*/ IoPoller *IoPoller::Create() {
+  Poller.watchedFd = -1;
+  if (pipe(Poller.wakePipe) == 0) {
+    for (int fd : Poller.wakePipe) {
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  } else {
+    Poller.wakePipe[0] = Poller.wakePipe[1] = -1;
+  }
+  return &Poller;
+}
+
+/*static*/ void IoPoller::Destroy(IoPoller *&p) {
+  auto self = reinterpret_cast<IoPollerPosix *>(p);
+  for (int &fd : self->wakePipe) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  self->watchedFd = -1;
+  p = nullptr;
+}
+
+void IoPoller::Watch(int fd, bool wantWrite) {
+  auto self = reinterpret_cast<IoPollerPosix *>(this);
+  self->watchedFd = fd;
+  self->wantWrite = wantWrite;
+}
+
+void IoPoller::Signal() {
+  auto self = reinterpret_cast<IoPollerPosix *>(this);
+  if (self->wakePipe[1] == -1) {
+    return;
+  }
+  const char one = 1;
+  [[maybe_unused]] auto res = write(self->wakePipe[1], &one, sizeof(one));
+}
+
+void IoPoller::Wait(Clock::time_point deadline) {
+  auto self = reinterpret_cast<IoPollerPosix *>(this);
+  if (self->wakePipe[0] == -1) {
+    const auto cap = Clock::now() + std::chrono::milliseconds{500};
+    std::this_thread::sleep_until(std::min(deadline, cap));
+    return;
+  }
+
+  int timeoutMs = -1;
+  if (deadline != Clock::time_point::max()) {
+    const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    timeoutMs = static_cast<int>(std::clamp<int64_t>(left, 0, 60 * 60 * 1000));
+  }
+
+  pollfd fds[2]{};
+  fds[0].fd = self->wakePipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = self->watchedFd;
+  fds[1].events = POLLIN | (self->wantWrite ? POLLOUT : 0);
+  const nfds_t count = self->watchedFd != -1 ? 2 : 1;
+
+  int res;
+  do {
+    res = poll(fds, count, timeoutMs);
+  } while (res < 0 && errno == EINTR);
+
+  if (res > 0 && (fds[0].revents & POLLIN)) {
+    char drain[64];
+    while (read(self->wakePipe[0], drain, sizeof(drain)) > 0) {
+    }
+  }
+}
+
+// A pipe; the host waits on the read end.
+struct CallbackNotifierPosix : public CallbackNotifier {
+  int fds[2]{-1, -1};
+};
+
+static CallbackNotifierPosix Notifier;
+
+/*static*/ CallbackNotifier *CallbackNotifier::Create() {
+  if (pipe(Notifier.fds) == 0) {
+    for (int fd : Notifier.fds) {
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  } else {
+    Notifier.fds[0] = Notifier.fds[1] = -1;
+  }
+  return &Notifier;
+}
+
+/*static*/ void CallbackNotifier::Destroy(CallbackNotifier *&p) {
+  auto self = reinterpret_cast<CallbackNotifierPosix *>(p);
+  for (int &fd : self->fds) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  p = nullptr;
+}
+
+int CallbackNotifier::Fd() { return reinterpret_cast<CallbackNotifierPosix *>(this)->fds[0]; }
+
+void CallbackNotifier::Raise() {
+  auto self = reinterpret_cast<CallbackNotifierPosix *>(this);
+  if (self->fds[1] == -1) {
+    return;
+  }
+  const char one = 1;
+  [[maybe_unused]] auto res = write(self->fds[1], &one, sizeof(one));
+}
+
+void CallbackNotifier::Clear() {
+  auto self = reinterpret_cast<CallbackNotifierPosix *>(this);
+  if (self->fds[0] == -1) {
+    return;
+  }
+  char drain[64];
+  while (read(self->fds[0], drain, sizeof(drain)) > 0) {
+  }
+}
@@ -0,0 +1,57 @@
+#include "io_poller.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+// Named pipes opened without overlapped io can't be waited on together with
+// an event, so we still look at the pipe every so often; Signal() and
+// deadlines wake us up early.
+struct IoPollerWin : public IoPoller {
+  std::mutex mutex;
+  std::condition_variable signaled;
+  bool pending{false};
+};
+
+static IoPollerWin Poller;
+
+/*static*/ IoPoller *IoPoller::Create() {
+  std::lock_guard guard(Poller.mutex);
+  Poller.pending = false;
+  return &Poller;
+}
+
+/*static*/ void IoPoller::Destroy(IoPoller *&p) { p = nullptr; }
+
+void IoPoller::Watch(int, bool) {}
+
+void IoPoller::Signal() {
+  auto self = reinterpret_cast<IoPollerWin *>(this);
+  {
+    std::lock_guard guard(self->mutex);
+    self->pending = true;
+  }
+  self->signaled.notify_all();
+}
+
+void IoPoller::Wait(Clock::time_point deadline) {
+  auto self = reinterpret_cast<IoPollerWin *>(this);
+  const auto pipeCheck = Clock::now() + std::chrono::milliseconds{500};
+  std::unique_lock lock(self->mutex);
+  self->signaled.wait_until(lock, std::min(deadline, pipeCheck), [self] { return self->pending; });
+  self->pending = false;
+}
+
+// Nothing a host loop could wait on; Discord_RunCallbacks still has to be
+// called.
+static CallbackNotifier Notifier;
+
+/*static*/ CallbackNotifier *CallbackNotifier::Create() { return &Notifier; }
+
+/*static*/ void CallbackNotifier::Destroy(CallbackNotifier *&p) { p = nullptr; }
+
+int CallbackNotifier::Fd() { return -1; }
+
+void CallbackNotifier::Raise() {}
+
+void CallbackNotifier::Clear() {}
@@ -0,0 +1,187 @@
+#include "json_escape.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DISCORD_ESCAPE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DISCORD_ESCAPE_SSE2
+#endif
+
+// Anything that can't be copied as is shows up in a bit mask: control
+// characters, quote, backslash and every byte of a multibyte sequence. As
+// signed bytes, both control characters and bytes >= 0x80 are below 0x20, so
+// one compare covers them. Plain ASCII runs are copied a vector at a time.
+#if defined(DISCORD_ESCAPE_AVX2)
+constexpr size_t VectorWidth = 32;
+static uint32_t SpecialMask(const unsigned char *in) {
+  const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+  const __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(special));
+}
+#elif defined(DISCORD_ESCAPE_SSE2)
+constexpr size_t VectorWidth = 16;
+static uint32_t SpecialMask(const unsigned char *in) {
+  const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+  const __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+  return static_cast<uint32_t>(_mm_movemask_epi8(special));
+}
+#endif
+
+#if defined(DISCORD_ESCAPE_AVX2) || defined(DISCORD_ESCAPE_SSE2)
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static unsigned FirstSetBit(uint32_t mask) {
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+}
+#else
+static unsigned FirstSetBit(uint32_t mask) { return static_cast<unsigned>(__builtin_ctz(mask)); }
+#endif
+#endif
+
+// Length of the well formed UTF-8 sequence at in, 0 if there isn't one:
+// stray continuation bytes, overlong forms, surrogates and anything past
+// U+10FFFF all count as broken.
+static size_t Utf8SequenceLength(const unsigned char *in, const size_t available) {
+  const unsigned char lead = in[0];
+  size_t length;
+  uint32_t codePoint;
+  uint32_t minimum;
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    codePoint = lead & 0x1F;
+    minimum = 0x80;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    codePoint = lead & 0x0F;
+    minimum = 0x800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    codePoint = lead & 0x07;
+    minimum = 0x10000;
+  } else {
+    return 0;
+  }
+  if (length > available) {
+    return 0;
+  }
+  for (size_t i = 1; i < length; ++i) {
+    if ((in[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+    codePoint = (codePoint << 6) | (in[i] & 0x3F);
+  }
+  if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+    return 0;
+  }
+  return length;
+}
+
+static char *EscapeAscii(char *out, const unsigned char c) {
+  static constexpr char Hex[] = "0123456789abcdef";
+  *out++ = '\\';
+  switch (c) {
+  case '"':
+    *out++ = '"';
+    break;
+  case '\\':
+    *out++ = '\\';
+    break;
+  case '\b':
+    *out++ = 'b';
+    break;
+  case '\f':
+    *out++ = 'f';
+    break;
+  case '\n':
+    *out++ = 'n';
+    break;
+  case '\r':
+    *out++ = 'r';
+    break;
+  case '\t':
+    *out++ = 't';
+    break;
+  default:
+    *out++ = 'u';
+    *out++ = '0';
+    *out++ = '0';
+    *out++ = Hex[c >> 4];
+    *out++ = Hex[c & 0xF];
+    break;
+  }
+  return out;
+}
+
+size_t JsonEscapeString(char *dest, const std::string_view src, size_t maxBytes, bool &truncated) {
+  static constexpr char Replacement[] = "\xEF\xBF\xBD";
+
+  const auto *in = reinterpret_cast<const unsigned char *>(src.data());
+  const auto *end = in + src.size();
+  char *out = dest;
+  truncated = false;
+
+  *out++ = '"';
+  while (in < end) {
+#if defined(DISCORD_ESCAPE_AVX2) || defined(DISCORD_ESCAPE_SSE2)
+    while (static_cast<size_t>(end - in) >= VectorWidth && maxBytes >= VectorWidth) {
+      const uint32_t mask = SpecialMask(in);
+      const size_t plain = mask ? FirstSetBit(mask) : VectorWidth;
+      std::memcpy(out, in, plain);
+      out += plain;
+      in += plain;
+      maxBytes -= plain;
+      if (mask) {
+        break;
+      }
+    }
+    if (in == end) {
+      break;
+    }
+#endif
+    // one character the slow way, then keep going here for as long as
+    // multibyte text lasts, it would only send us straight back
+    do {
+      const unsigned char c = *in;
+      if (c < 0x80) {
+        if (!maxBytes) {
+          truncated = true;
+          break;
+        }
+        if (c < 0x20 || c == '"' || c == '\\') {
+          out = EscapeAscii(out, c);
+        } else {
+          *out++ = static_cast<char>(c);
+        }
+        ++in;
+        --maxBytes;
+        continue;
+      }
+
+      const size_t length = Utf8SequenceLength(in, static_cast<size_t>(end - in));
+      const size_t outLength = length ? length : sizeof(Replacement) - 1;
+      if (outLength > maxBytes) {
+        truncated = true;
+        break;
+      }
+      std::memcpy(out, length ? reinterpret_cast<const char *>(in) : Replacement, outLength);
+      out += outLength;
+      in += length ? length : 1;
+      maxBytes -= outLength;
+    } while (in < end && *in >= 0x80);
+
+    if (truncated) {
+      break;
+    }
+  }
+  *out++ = '"';
+
+  return static_cast<size_t>(out - dest);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Bytes JsonEscapeString can write for at most maxBytes of input: quotes plus
+// \u00XX for every byte in the worst case.
+constexpr size_t JsonEscapedBound(size_t maxBytes) { return 2 + maxBytes * 6; }
+
+// Writes src as a quoted JSON string. Invalid UTF-8 comes out as U+FFFD, and
+// at most maxBytes of UTF-8 are kept, cut at a code point boundary; truncated
+// says whether anything was dropped. dest needs JsonEscapedBound(maxBytes)
+// bytes of room. Returns the number of bytes written, no null terminator.
+size_t JsonEscapeString(char *dest, std::string_view src, size_t maxBytes, bool &truncated);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// How many things waited, for how long in total and at worst, in
+// microseconds. One thread records, any thread can read.
+struct LatencyStats {
+  std::atomic_uint64_t count{0};
+  std::atomic_uint64_t totalMicros{0};
+  std::atomic_uint64_t maxMicros{0};
+
+  void record(const std::chrono::steady_clock::duration waited) {
+    const auto micros = static_cast<uint64_t>(
+        std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(waited).count()));
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalMicros.fetch_add(micros, std::memory_order_relaxed);
+    if (micros > maxMicros.load(std::memory_order_relaxed)) {
+      maxMicros.store(micros, std::memory_order_relaxed);
+    }
+  }
+};
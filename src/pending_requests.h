@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Which command a request was, for the round trip stats. Matches the
+// DISCORD_COMMAND_* indices in discord_rpc.h.
+enum class CommandKind : uint8_t { SetActivity, Subscribe, Unsubscribe, JoinReply, Other, Count };
+
+// What became of a request, same values as DISCORD_RESULT_*.
+enum class RequestResult : int { Ok, Error, TimedOut, Disconnected };
+
+// Same as DiscordCommandCallback. Called on the io thread; response is the
+// data member of the reply, only valid during the call and null unless
+// Discord answered.
+using RequestCallback = void (*)(void *userdata, int result, const char *response, uint32_t length);
+
+// What needs to be known about a command once its reply comes in; it travels
+// through the send queue with the command.
+struct RequestInfo {
+  int nonce{0};
+  CommandKind kind{CommandKind::Other};
+  RequestCallback callback{nullptr};
+  void *userdata{nullptr};
+};
+
+// Requests written to the socket but not answered yet, by nonce. Open
+// addressing with linear probing; removing an entry moves the ones probed
+// past it back instead of leaving tombstones, so lookups never walk further
+// than the longest run. Nonce 0 marks a free slot and is never tracked.
+// io thread only.
+template <size_t Capacity> class PendingRequests {
+  static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+  static constexpr size_t Mask = Capacity - 1;
+
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    RequestInfo info;
+    Clock::time_point sentAt;
+  };
+
+private:
+  Entry slots_[Capacity]{};
+  size_t count_{0};
+
+  static size_t Home(const int nonce) { return (static_cast<uint32_t>(nonce) * 0x9E3779B1u) & Mask; }
+
+  size_t Find(const int nonce) const {
+    if (nonce) {
+      for (size_t i = Home(nonce), probes = 0; probes < Capacity && slots_[i].info.nonce; i = (i + 1) & Mask, ++probes) {
+        if (slots_[i].info.nonce == nonce) {
+          return i;
+        }
+      }
+    }
+    return Capacity;
+  }
+
+  void RemoveAt(size_t hole) {
+    // a full table has no free slot to end the run, so stop after one lap
+    size_t i = (hole + 1) & Mask;
+    for (size_t steps = 1; steps < Capacity && slots_[i].info.nonce; i = (i + 1) & Mask, ++steps) {
+      // it can fill the hole unless its home lies between the hole and it
+      if (((i - Home(slots_[i].info.nonce)) & Mask) >= ((i - hole) & Mask)) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole] = {};
+    --count_;
+  }
+
+public:
+  PendingRequests() {}
+
+  size_t Count() const { return count_; }
+
+  // Starts tracking a request that was just written. When every slot is
+  // taken, the oldest request is pushed out and handed back in evicted to be
+  // failed; returns whether that happened.
+  bool Insert(const RequestInfo &info, const Clock::time_point sentAt, Entry &evicted) {
+    if (!info.nonce || Find(info.nonce) != Capacity) {
+      return false;
+    }
+    bool full = count_ == Capacity;
+    if (full) {
+      size_t oldest = 0;
+      for (size_t i = 1; i < Capacity; ++i) {
+        if (slots_[i].sentAt < slots_[oldest].sentAt) {
+          oldest = i;
+        }
+      }
+      evicted = slots_[oldest];
+      RemoveAt(oldest);
+    }
+    size_t i = Home(info.nonce);
+    while (slots_[i].info.nonce) {
+      i = (i + 1) & Mask;
+    }
+    slots_[i] = {info, sentAt};
+    ++count_;
+    return full;
+  }
+
+  // Stops tracking nonce; false if it wasn't.
+  bool Take(const int nonce, Entry &entry) {
+    const size_t i = Find(nonce);
+    if (i == Capacity) {
+      return false;
+    }
+    entry = slots_[i];
+    RemoveAt(i);
+    return true;
+  }
+
+  // Whether someone wants to see the reply to nonce, not just know it came.
+  bool WantsResponse(const int nonce) const {
+    const size_t i = Find(nonce);
+    return i != Capacity && slots_[i].info.callback;
+  }
+
+  // Hands every request sent before cutoff to expired(entry), and stops
+  // tracking it.
+  template <typename Fn> void Expire(const Clock::time_point cutoff, Fn expired) {
+    for (size_t i = 0; i < Capacity && count_;) {
+      if (slots_[i].info.nonce && slots_[i].sentAt < cutoff) {
+        const Entry entry = slots_[i];
+        RemoveAt(i);
+        expired(entry);
+        // something may have moved into i
+        continue;
+      }
+      ++i;
+    }
+  }
+  template <typename Fn> void Clear(Fn cleared) { Expire(Clock::time_point::max(), cleared); }
+
+  // When the oldest request was sent, max() if there is none.
+  Clock::time_point OldestSent() const {
+    auto oldest = Clock::time_point::max();
+    for (size_t i = 0; i < Capacity && count_; ++i) {
+      if (slots_[i].info.nonce && slots_[i].sentAt < oldest) {
+        oldest = slots_[i].sentAt;
+      }
+    }
+    return oldest;
+  }
+};
@@ -1,7 +1,7 @@
 #include "rpc_connection.h"
 #include "serialization.h"
 
-#include <glaze/glaze.hpp>
+#include <cstring>
 #include <utility>
 
 static constexpr int RpcVersion = 1;
@@ -24,36 +24,29 @@ void RpcConnection::Open() {
     return;
   }
 
-  if (state == State::Disconnected && !connection->Open()) {
-    return;
-  }
-
-  if (state == State::SentHandshake) {
-    glz::json_t message;
-    if (Read(message)) {
-      std::string cmd;
-      if (!message["cmd"].is_null()) {
-        cmd = message["cmd"].get_string();
-      }
-      std::string evt;
-      if (!message["evt"].is_null()) {
-        evt = message["evt"].get_string();
-      }
-      if (!cmd.empty() && !evt.empty() && !strcmp(cmd.c_str(), "DISPATCH") && !strcmp(evt.c_str(), "READY")) {
-        state = State::Connected;
-        if (onConnect) {
-          onConnect(message);
-        }
-      }
+  if (state == State::Disconnected) {
+    if (!connection->Open()) {
+      return;
     }
-  } else {
-    sendFrame.opcode = Opcode::Handshake;
-    sendFrame.length = static_cast<uint32_t>(JsonWriteHandshakeObj(sendFrame.message, sizeof(sendFrame.message), RpcVersion, appId));
+    openedAt = std::chrono::steady_clock::now();
 
-    if (connection->Write(&sendFrame, sizeof(MessageFrameHeader) + sendFrame.length)) {
-      state = State::SentHandshake;
-    } else {
+    char handshake[512];
+    const size_t length = JsonWriteHandshakeObj(handshake, sizeof(handshake), RpcVersion, appId);
+    if (!WriteFrame(Opcode::Handshake, handshake, length)) {
       Close();
+      return;
+    }
+    state = State::SentHandshake;
+  }
+
+  RpcMessage message;
+  if (Read(message)) {
+    if (message.cmd == "DISPATCH" && message.evt == "READY") {
+      state = State::Connected;
+      lastReadyMicros.store(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - openedAt).count());
+      if (onConnect) {
+        onConnect(message);
+      }
     }
   }
 }
@@ -65,64 +58,224 @@ void RpcConnection::Close() {
   }
   connection->Close();
   state = State::Disconnected;
+  inboundStart = inboundEnd = 0;
+  inboundDrained = false;
+  outboundStart = outboundEnd = 0;
 }
 
 bool RpcConnection::Write(const void *data, const size_t length) {
-  sendFrame.opcode = Opcode::Frame;
-  memcpy(sendFrame.message, data, length);
-  sendFrame.length = static_cast<uint32_t>(length);
-  if (!connection->Write(&sendFrame, sizeof(MessageFrameHeader) + length)) {
-    Close();
-    return false;
-  }
-  return true;
+  return WriteFrame(Opcode::Frame, data, length);
 }
 
-bool RpcConnection::Read(glz::json_t& message) {
-  if (state != State::Connected && state != State::SentHandshake) {
-    return false;
+bool RpcConnection::WriteFrame(const Opcode opcode, const void *data, const size_t length) {
+  const IoSlice payload{data, length};
+  return WriteFrames(opcode, &payload, 1) == 1;
+}
+
+size_t RpcConnection::WriteFrames(const Opcode opcode, const IoSlice *payloads, size_t count) {
+  if (!Flush()) {
+    return 0;
   }
-  MessageFrame readFrame;
-  for (;;) {
-    bool didRead = connection->Read(&readFrame, sizeof(MessageFrameHeader));
-    if (!didRead) {
+
+  const size_t pending = PendingWriteBytes();
+  if (pending >= OutboundHighWaterMark) {
+    writesDeferred.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  // Only take frames whose unsent remainder is sure to fit in the outbound
+  // buffer, whatever the socket ends up accepting.
+  if (count > MaxFramesPerWrite) {
+    count = MaxFramesPerWrite;
+  }
+  MessageFrameHeader headers[MaxFramesPerWrite];
+  IoSlice slices[MaxFramesPerWrite * 2];
+  size_t sliceCount = 0;
+  size_t total = 0;
+  size_t taken = 0;
+  for (; taken < count; ++taken) {
+    const size_t frameSize = sizeof(MessageFrameHeader) + payloads[taken].length;
+    if (frameSize > sizeof(outbound)) {
+      // can never be sent; drop it rather than stall everything behind it
+      continue;
+    }
+    if (pending + total + frameSize > sizeof(outbound)) {
+      writesDeferred.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+    headers[taken].opcode = opcode;
+    headers[taken].length = static_cast<uint32_t>(payloads[taken].length);
+    slices[sliceCount++] = {&headers[taken], sizeof(MessageFrameHeader)};
+    if (payloads[taken].length) {
+      slices[sliceCount++] = payloads[taken];
+    }
+    total += frameSize;
+  }
+  if (!total) {
+    return taken;
+  }
+
+  // Anything still pending has to go out first, otherwise try the socket
+  // directly and only keep what it didn't take.
+  size_t sent = 0;
+  if (!pending) {
+    sent = connection->WriteV(slices, sliceCount);
+    writeCalls.fetch_add(1, std::memory_order_relaxed);
+    if (!connection->isOpen) {
+      lastErrorCode = std::to_underlying(ErrorCode::PipeClosed);
+      StringCopy(lastErrorMessage, "Pipe closed");
+      Close();
+      return 0;
+    }
+  }
+  if (sent < total) {
+    if (outboundEnd + total - sent > sizeof(outbound)) {
+      memmove(outbound, outbound + outboundStart, pending);
+      outboundStart = 0;
+      outboundEnd = pending;
+    }
+    for (size_t i = 0; i < sliceCount; ++i) {
+      const size_t skip = sent < slices[i].length ? sent : slices[i].length;
+      sent -= skip;
+      memcpy(outbound + outboundEnd, static_cast<const char *>(slices[i].data) + skip, slices[i].length - skip);
+      outboundEnd += slices[i].length - skip;
+    }
+    const auto pendingNow = static_cast<uint32_t>(PendingWriteBytes());
+    if (pendingNow > outboundPeakBytes.load(std::memory_order_relaxed)) {
+      outboundPeakBytes.store(pendingNow, std::memory_order_relaxed);
+    }
+  }
+  framesWritten.fetch_add(taken, std::memory_order_relaxed);
+  return taken;
+}
+
+bool RpcConnection::Flush() {
+  while (outboundStart < outboundEnd) {
+    const size_t sent = connection->Write(outbound + outboundStart, outboundEnd - outboundStart);
+    writeCalls.fetch_add(1, std::memory_order_relaxed);
+    if (!sent) {
       if (!connection->isOpen) {
         lastErrorCode = std::to_underlying(ErrorCode::PipeClosed);
         StringCopy(lastErrorMessage, "Pipe closed");
         Close();
+        return false;
       }
-      return false;
+      return true;
     }
+    outboundStart += sent;
+  }
+  outboundStart = outboundEnd = 0;
+  return true;
+}
+
+// Hands out the next complete frame in the inbound buffer, reading more when
+// there isn't one yet. A frame may arrive over any number of reads; partial
+// data just stays in the buffer until the rest shows up. Once a read comes
+// back short we assume the socket is empty and stop until the next call
+// rather than spend another syscall to find out.
+bool RpcConnection::ReadFrame(MessageFrameHeader &header, const char *&payload) {
+  constexpr size_t headerSize = sizeof(MessageFrameHeader);
 
-    if (readFrame.length > 0) {
-      didRead = connection->Read(readFrame.message, readFrame.length);
-      if (!didRead) {
+  for (;;) {
+    const size_t available = inboundEnd - inboundStart;
+    if (available >= headerSize) {
+      memcpy(&header, inbound + inboundStart, headerSize);
+      if (header.length > sizeof(inbound) - headerSize) {
         lastErrorCode = std::to_underlying(ErrorCode::ReadCorrupt);
-        StringCopy(lastErrorMessage, "Partial data in frame");
+        StringCopy(lastErrorMessage, "Frame too large");
         Close();
         return false;
       }
-      readFrame.message[readFrame.length] = 0;
+      if (available >= headerSize + header.length) {
+        payload = inbound + inboundStart + headerSize;
+        inboundStart += headerSize + header.length;
+        if (inboundStart == inboundEnd) {
+          // the bytes stay where they are until the next read
+          inboundStart = inboundEnd = 0;
+        }
+        framesRead.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    if (inboundDrained) {
+      inboundDrained = false;
+      return false;
+    }
+
+    if (inboundStart) {
+      memmove(inbound, inbound + inboundStart, available);
+      inboundStart = 0;
+      inboundEnd = available;
+    }
+    const size_t want = sizeof(inbound) - inboundEnd;
+    const size_t got = connection->Read(inbound + inboundEnd, want);
+    readCalls.fetch_add(1, std::memory_order_relaxed);
+    if (!got) {
+      return false;
+    }
+    inboundEnd += got;
+    inboundDrained = got < want;
+  }
+}
+
+bool RpcConnection::Read(RpcMessage &message) {
+  auto budget = CallBudget::unlimited();
+  return Read(message, budget);
+}
+
+bool RpcConnection::Read(RpcMessage &message, CallBudget &budget) {
+  if (state != State::Connected && state != State::SentHandshake) {
+    return false;
+  }
+  for (;; budget.spend()) {
+    if (budget.exhausted()) {
+      return false;
+    }
+    MessageFrameHeader header;
+    const char *payload;
+    if (!ReadFrame(header, payload)) {
+      if (!connection->isOpen && state != State::Disconnected) {
+        lastErrorCode = std::to_underlying(ErrorCode::PipeClosed);
+        StringCopy(lastErrorMessage, "Pipe closed");
+        Close();
+      }
+      return false;
     }
 
-    glz::error_ctx ec;
-    switch (readFrame.opcode) {
+    const std::string_view json(payload, header.length);
+    switch (header.opcode) {
     case Opcode::Close: {
-      ec = glz::read_json(message, readFrame.message);
-      assert(!ec);
-      lastErrorCode = message["code"].as<std::int32_t>();
-      StringCopy(lastErrorMessage, message["message"].get_string().c_str());
+      ErrorData close;
+      if (JsonReadData(json, close)) {
+        lastErrorCode = close.code;
+        JsonStringCopy(lastErrorMessage, close.message);
+      } else {
+        lastErrorCode = std::to_underlying(ErrorCode::ReadCorrupt);
+        StringCopy(lastErrorMessage, "Bad close frame");
+      }
       Close();
       return false;
     }
     case Opcode::Frame:
-      ec = glz::read_json(message, readFrame.message);
-      assert(!ec);
-      return true;
+      if (state == State::Connected && wantsFrame) {
+        std::string_view evt;
+        bool hasNonce;
+        int nonce;
+        if (JsonPeekMessage(json, evt, hasNonce, nonce) && !wantsFrame(evt, hasNonce, nonce)) {
+          framesFiltered.fetch_add(1, std::memory_order_relaxed);
+          break;
+        }
+      }
+      if (JsonReadMessage(json, message)) {
+        budget.spend();
+        return true;
+      }
+      // not something we can make sense of, skip it
+      break;
     case Opcode::Ping:
-      readFrame.opcode = Opcode::Pong;
-      if (!connection->Write(&readFrame, sizeof(MessageFrameHeader) + readFrame.length)) {
-        Close();
+      if (!WriteFrame(Opcode::Pong, payload, header.length) && !connection->isOpen) {
+        return false;
       }
       break;
     case Opcode::Pong:
@@ -1,13 +1,23 @@
 #pragma once
 
+#include "call_budget.h"
 #include "connection.h"
 #include "serialization.h"
-#include <glaze/glaze.hpp>
+#include <atomic>
+#include <chrono>
 
 // I took this from the buffer size libuv uses for named pipes; I suspect ours
 // would usually be much smaller.
 constexpr size_t MaxRpcFrameSize = 64 * 1024;
 
+// Bytes the socket didn't take yet are kept and sent on a later call. While
+// more than this is waiting, Write() turns new frames away so callers can
+// hold on to them instead of piling up behind a stalled client.
+constexpr size_t OutboundHighWaterMark = 32 * 1024;
+
+// Most frames handed to the socket in one gather write.
+constexpr size_t MaxFramesPerWrite = 16;
+
 struct RpcConnection {
   enum class ErrorCode : int {
     Success = 0,
@@ -28,10 +38,6 @@ struct RpcConnection {
     uint32_t length;
   };
 
-  struct MessageFrame : MessageFrameHeader {
-    char message[MaxRpcFrameSize - sizeof(MessageFrameHeader)];
-  };
-
   enum class State : uint32_t {
     Disconnected,
     SentHandshake,
@@ -41,20 +47,57 @@ struct RpcConnection {
 
   BaseConnection *connection{nullptr};
   State state{State::Disconnected};
-  void (*onConnect)(glz::json_t& message){nullptr};
+  void (*onConnect)(const RpcMessage &readyMessage){nullptr};
   void (*onDisconnect)(int errorCode, const char *message){nullptr};
+  // Once connected, frames this turns down are dropped before being parsed.
+  bool (*wantsFrame)(std::string_view evt, bool hasNonce, int nonce){nullptr};
   char appId[64]{};
   int lastErrorCode{0};
   char lastErrorMessage[256]{};
-  MessageFrame sendFrame;
+  // Received bytes, [inboundStart, inboundEnd). Each read takes as much as
+  // fits and frames are parsed where they sit, so messages handed out by
+  // Read() point in here until the next Read().
+  char inbound[MaxRpcFrameSize];
+  size_t inboundStart{0};
+  size_t inboundEnd{0};
+  // the last read came back short, the socket is most likely empty
+  bool inboundDrained{false};
+  // written but not yet taken by the socket, [outboundStart, outboundEnd)
+  char outbound[MaxRpcFrameSize];
+  size_t outboundStart{0};
+  size_t outboundEnd{0};
+  std::chrono::steady_clock::time_point openedAt{};
+  // time from the socket connecting to READY, for the latest connection
+  std::atomic<int64_t> lastReadyMicros{0};
+  std::atomic<uint64_t> framesFiltered{0};
+  std::atomic<uint64_t> writesDeferred{0};
+  std::atomic<uint32_t> outboundPeakBytes{0};
+  std::atomic<uint64_t> writeCalls{0};
+  std::atomic<uint64_t> framesWritten{0};
+  std::atomic<uint64_t> readCalls{0};
+  std::atomic<uint64_t> framesRead{0};
 
   static RpcConnection *Create(const char *applicationId);
   static void Destroy(RpcConnection *&);
 
   inline bool IsOpen() const { return state == State::Connected; }
+  inline size_t PendingWriteBytes() const { return outboundEnd - outboundStart; }
 
   void Open();
   void Close();
+  // False if the frame wasn't taken, either because the connection closed or
+  // because too much is still waiting to go out (IsOpen() tells which).
   bool Write(const void *data, size_t length);
-  bool Read(glz::json_t& message);
+  bool WriteFrame(Opcode opcode, const void *data, size_t length);
+  // Sends each payload as its own frame, all in one gather write, straight
+  // from the caller's buffers. Returns how many payloads, from the front, were
+  // taken; the rest should be offered again later.
+  size_t WriteFrames(Opcode opcode, const IoSlice *payloads, size_t count);
+  // Pushes out what earlier writes left behind; false if the pipe closed.
+  bool Flush();
+  // Every frame taken off the socket counts against budget, the ones skipped
+  // on the way to message included; false once it runs out as well.
+  bool Read(RpcMessage &message, CallBudget &budget);
+  bool Read(RpcMessage &message);
+  bool ReadFrame(MessageFrameHeader &header, const char *&payload);
 };
@@ -1,6 +1,7 @@
 #include "serialization.h"
 #include "connection.h"
 #include "discord_rpc.h"
+#include "json_escape.h"
 
 #pragma warning(push)
 #pragma warning(disable : 4800)
@@ -8,156 +9,819 @@
 #include <glaze/glaze.hpp>
 #pragma warning(pop)
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
 #pragma warning(push)
 #pragma warning(disable : 5246)
 
-size_t JsonWriteRichPresenceObj(char *dest, const size_t maxLen, const int nonce, const int pid, const DiscordRichPresence *presence) {
-  glz::json_t message;
-  message["nonce"] = (double)nonce;
-  message["cmd"] = std::string("SET_ACTIVITY");
-  message["args"]["pid"] = (double)pid;
+// Outgoing commands. Members are laid out in the order they are written and
+// empty optionals are skipped, so no document has to be built at runtime.
+// Presence strings are escaped by JsonEscapeString beforehand and handed
+// over as raw json.
+
+struct HandshakeObj {
+  int v;
+  std::string_view clientId;
+};
+
+struct ActivityTimestamps {
+  std::optional<int64_t> start;
+  std::optional<int64_t> end;
+};
+
+struct ActivityAssets {
+  std::optional<glz::raw_json_view> largeImage;
+  std::optional<glz::raw_json_view> largeText;
+  std::optional<glz::raw_json_view> smallImage;
+  std::optional<glz::raw_json_view> smallText;
+};
+
+struct ActivityParty {
+  glz::raw_json_view id;
+  std::optional<std::array<int, 2>> size;
+  std::optional<int> privacy;
+};
+
+struct ActivitySecrets {
+  glz::raw_json_view match;
+  glz::raw_json_view join;
+  glz::raw_json_view spectate;
+};
+
+struct Activity {
+  std::optional<glz::raw_json_view> state;
+  std::optional<glz::raw_json_view> details;
+  std::optional<ActivityTimestamps> timestamps;
+  std::optional<ActivityAssets> assets;
+  std::optional<ActivityParty> party;
+  std::optional<ActivitySecrets> secrets;
+  bool instance;
+};
+
+struct SetActivityArgs {
+  int pid;
+  std::optional<Activity> activity;
+};
+
+struct SetActivityCommand {
+  int nonce;
+  std::string_view cmd;
+  SetActivityArgs args;
+};
+
+struct SubscriptionCommand {
+  int nonce;
+  std::string_view cmd;
+  std::string_view evt;
+};
+
+struct JoinReplyArgs {
+  std::string_view userId;
+};
+
+struct JoinReplyCommand {
+  int nonce;
+  std::string_view cmd;
+  JoinReplyArgs args;
+};
+
+template <> struct glz::meta<HandshakeObj> {
+  using T = HandshakeObj;
+  static constexpr auto value = object("v", &T::v, "client_id", &T::clientId);
+};
+
+template <> struct glz::meta<ActivityAssets> {
+  using T = ActivityAssets;
+  static constexpr auto value = object("large_image", &T::largeImage, "large_text", &T::largeText, "small_image", &T::smallImage, "small_text", &T::smallText);
+};
+
+template <> struct glz::meta<JoinReplyArgs> {
+  using T = JoinReplyArgs;
+  static constexpr auto value = object("user_id", &T::userId);
+};
+
+// Bytes a string can take once quoted and escaped, worst case being \u00XX
+// for every byte.
+static size_t EscapedBound(std::string_view str) { return 2 + str.size() * 6; }
+static size_t EscapedBound(const char *str) { return str ? EscapedBound(std::string_view(str)) : 0; }
+
+// Room for keys, punctuation and numbers on top of the string values.
+constexpr size_t CommandOverhead = 512;
+
+// Serializes straight into dest when the result is known to fit. Only
+// oversized input goes through a temporary string, which is cut down to
+// maxLen the way it always was.
+template <typename T> static size_t WriteCommand(char *dest, const size_t maxLen, const T &command, const size_t stringBound) {
+  if (!maxLen) {
+    return 0;
+  }
+
+  if (stringBound + CommandOverhead < maxLen) {
+    const auto written = glz::write<glz::opts{}>(command, dest);
+    assert(written);
+    if (written) {
+      dest[*written] = '\0';
+      return *written;
+    }
+    dest[0] = '\0';
+    return 0;
+  }
+
+  std::string buff{};
+  const auto ec = glz::write<glz::opts{}>(command, buff);
+  assert(!ec);
+
+  size_t len = buff.size();
+  if (len >= maxLen) {
+    len = maxLen - 1; // leave space for null terminator
+  }
+
+  std::memcpy(dest, buff.data(), len);
+  dest[len] = '\0';
+
+  return len;
+}
+
+// Both presence structs go through the same code; these paper over null
+// terminated versus sized strings.
+static bool IsSet(const char *str) { return str != nullptr; }
+static bool IsSet(const DiscordStringView &str) { return str.data != nullptr; }
+static std::string_view View(const char *str) { return str ? std::string_view(str) : std::string_view(); }
+static std::string_view View(const DiscordStringView &str) { return str.data ? std::string_view(str.data, str.length) : std::string_view(); }
+
+// The limits documented in discord_rpc.h. Discord refuses longer text, so it
+// gets cut at a code point boundary instead.
+constexpr size_t MaxTextBytes{128};
+constexpr size_t MaxImageKeyBytes{32};
+constexpr size_t PresenceStringsSize{2 * JsonEscapedBound(MaxImageKeyBytes) + 8 * JsonEscapedBound(MaxTextBytes)};
+
+static std::atomic_uint64_t TruncatedStrings{0};
+
+uint64_t JsonTruncatedStrings() { return TruncatedStrings.load(); }
+
+static size_t EscapeText(char *dest, std::string_view str, size_t maxBytes) {
+  bool truncated;
+  const size_t len = JsonEscapeString(dest, str, maxBytes, truncated);
+  if (truncated) {
+    TruncatedStrings.fetch_add(1, std::memory_order_relaxed);
+  }
+  return len;
+}
+
+// All the strings of one presence, escaped back to back.
+struct EscapedStrings {
+  char buffer[PresenceStringsSize];
+  size_t used{0};
+
+  template <typename String> std::optional<glz::raw_json_view> Add(const String &str, const size_t maxBytes) {
+    if (!IsSet(str)) {
+      return std::nullopt;
+    }
+    const size_t len = EscapeText(buffer + used, View(str), maxBytes);
+    glz::raw_json_view json{std::string_view(buffer + used, len)};
+    used += len;
+    return json;
+  }
+};
+
+template <typename Presence> static size_t WriteRichPresence(char *dest, const size_t maxLen, const int nonce, const int pid, const Presence *presence) {
+  SetActivityCommand command{nonce, "SET_ACTIVITY", {pid, std::nullopt}};
+  EscapedStrings strings;
+
   if (presence) {
-    message["args"]["activity"]["state"] = std::string(presence->state);
-    message["args"]["activity"]["details"] = std::string(presence->details);
+    Activity &activity = command.args.activity.emplace();
+    activity.state = strings.Add(presence->state, MaxTextBytes);
+    activity.details = strings.Add(presence->details, MaxTextBytes);
 
     /** timestamp */
-    if (presence->startTimestamp) {
-      message["args"]["activity"]["timestamps"]["start"] = (double)presence->startTimestamp;
-    }
-    if (presence->endTimestamp) {
-      message["args"]["activity"]["timestamps"]["end"] = (double)presence->endTimestamp;
+    if (presence->startTimestamp || presence->endTimestamp) {
+      auto &timestamps = activity.timestamps.emplace();
+      if (presence->startTimestamp) {
+        timestamps.start = presence->startTimestamp;
+      }
+      if (presence->endTimestamp) {
+        timestamps.end = presence->endTimestamp;
+      }
     }
 
     /** assets */
-    if (presence->largeImageKey) {
-      message["args"]["activity"]["assets"]["large_image"] = std::string(presence->largeImageKey);
-    }
-    if (presence->largeImageText) {
-      message["args"]["activity"]["assets"]["large_text"] = std::string(presence->largeImageText);
-    }
-    if (presence->smallImageKey) {
-      message["args"]["activity"]["assets"]["small_image"] = std::string(presence->smallImageKey);
-    }
-    if (presence->smallImageText) {
-      message["args"]["activity"]["assets"]["small_text"] = std::string(presence->smallImageText);
+    if (IsSet(presence->largeImageKey) || IsSet(presence->largeImageText) || IsSet(presence->smallImageKey) || IsSet(presence->smallImageText)) {
+      auto &assets = activity.assets.emplace();
+      assets.largeImage = strings.Add(presence->largeImageKey, MaxImageKeyBytes);
+      assets.largeText = strings.Add(presence->largeImageText, MaxTextBytes);
+      assets.smallImage = strings.Add(presence->smallImageKey, MaxImageKeyBytes);
+      assets.smallText = strings.Add(presence->smallImageText, MaxTextBytes);
     }
 
     /** party */
-    if (presence->partyId) {
-      message["args"]["activity"]["party"]["id"] = std::string(presence->partyId);
+    if (IsSet(presence->partyId)) {
+      auto &party = activity.party.emplace();
+      party.id = *strings.Add(presence->partyId, MaxTextBytes);
       if (presence->partySize && presence->partyMax) {
-        message["args"]["activity"]["party"]["size"] = glz::json_t::array_t{(double)presence->partySize, (double)presence->partyMax};
+        party.size = std::array<int, 2>{presence->partySize, presence->partyMax};
       }
       if (presence->partyPrivacy) {
-        message["args"]["activity"]["party"]["privacy"] = (double)presence->partyPrivacy;
+        party.privacy = presence->partyPrivacy;
       }
     }
 
-    if (presence->matchSecret && presence->joinSecret && presence->spectateSecret) {
-      message["args"]["activity"]["secrets"]["match"] = std::string(presence->matchSecret);
-      message["args"]["activity"]["secrets"]["join"] = std::string(presence->joinSecret);
-      message["args"]["activity"]["secrets"]["spectate"] = std::string(presence->spectateSecret);
+    if (IsSet(presence->matchSecret) && IsSet(presence->joinSecret) && IsSet(presence->spectateSecret)) {
+      activity.secrets = ActivitySecrets{*strings.Add(presence->matchSecret, MaxTextBytes), *strings.Add(presence->joinSecret, MaxTextBytes), *strings.Add(presence->spectateSecret, MaxTextBytes)};
     }
 
-    message["args"]["activity"]["instance"] = presence->instance != 0;
+    activity.instance = presence->instance != 0;
   }
 
-  std::string buff{};
-  const auto ec = glz::write_json(message, buff);
-  assert(!ec);
+  return WriteCommand(dest, maxLen, command, strings.used);
+}
 
-  size_t len = buff.size();
-  if (len >= maxLen) {
-    len = maxLen - 1; // leave space for null terminator
+size_t JsonWriteRichPresenceObj(char *dest, const size_t maxLen, const int nonce, const int pid, const DiscordRichPresence *presence) {
+  return WriteRichPresence(dest, maxLen, nonce, pid, presence);
+}
+
+size_t JsonWriteRichPresenceObj(char *dest, const size_t maxLen, const int nonce, const int pid, const DiscordRichPresenceEx *presence) {
+  return WriteRichPresence(dest, maxLen, nonce, pid, presence);
+}
+
+// FNV-1a, with whether it's set and its length in front of every string so
+// null, empty and adjacent strings can't run into each other.
+constexpr uint64_t FnvOffsetBasis{14695981039346656037ull};
+constexpr uint64_t FnvPrime{1099511628211ull};
+
+static void HashBytes(uint64_t &hash, const void *data, const size_t length) {
+  auto bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ bytes[i]) * FnvPrime;
   }
+}
 
-  std::memcpy(dest, buff.data(), len);
-  dest[len] = '\0';
+template <typename T> static void HashValue(uint64_t &hash, const T value) {
+  HashBytes(hash, &value, sizeof(value));
+}
 
-  return len;
+template <typename String> static void HashString(uint64_t &hash, const String &str) {
+  HashValue(hash, IsSet(str));
+  if (IsSet(str)) {
+    const auto view = View(str);
+    HashValue(hash, view.size());
+    HashBytes(hash, view.data(), view.size());
+  }
 }
 
-size_t JsonWriteHandshakeObj(char *dest, const size_t maxLen, int version, const char *applicationId) {
-  glz::json_t message;
-  message["v"] = (double)version;
-  message["client_id"] = std::string(applicationId);
+template <typename Presence> static uint64_t HashRichPresence(const Presence *presence) {
+  uint64_t hash = FnvOffsetBasis;
+  HashValue(hash, presence != nullptr);
+  if (presence) {
+    for (const auto &str : {presence->state, presence->details, presence->largeImageKey, presence->largeImageText, presence->smallImageKey, presence->smallImageText, presence->partyId, presence->matchSecret, presence->joinSecret,
+                            presence->spectateSecret}) {
+      HashString(hash, str);
+    }
+    HashValue(hash, presence->startTimestamp);
+    HashValue(hash, presence->endTimestamp);
+    HashValue(hash, presence->partySize);
+    HashValue(hash, presence->partyMax);
+    HashValue(hash, presence->partyPrivacy);
+    HashValue(hash, presence->instance != 0);
+  }
+  return hash ? hash : 1;
+}
 
-  std::string buff{};
-  const auto ec = glz::write_json(message, buff);
-  assert(!ec);
+uint64_t RichPresenceHash(const DiscordRichPresence *presence) { return HashRichPresence(presence); }
+uint64_t RichPresenceHash(const DiscordRichPresenceEx *presence) { return HashRichPresence(presence); }
+
+// Presence templates. The skeleton is an ordinary SET_ACTIVITY written with
+// placeholders in the open fields, which are cut out again so only their
+// offsets remain. Quotes inside string values always come out escaped, so
+// `"key":` followed by a placeholder can only match where glaze put it.
+// Every optional activity member is followed by at least "instance", so the
+// holes take the whole member with its comma and leaving one out is simply
+// writing nothing.
+
+constexpr size_t MaxTemplateSize{16 * 1024};
+constexpr std::string_view NoncePlaceholder{R"({"nonce":0,)"};
+
+struct TemplateCut {
+  size_t offset;
+  size_t length;
+  PresenceTemplate::Slot slot;
+};
+
+static bool FindPlaceholder(const std::string &json, std::string_view placeholder, PresenceTemplate::Slot slot, TemplateCut *cuts, size_t &count) {
+  const size_t pos = json.find(placeholder);
+  if (pos == std::string::npos || json.find(placeholder, pos + 1) != std::string::npos) {
+    return false;
+  }
+  cuts[count++] = {pos, placeholder.size(), slot};
+  return true;
+}
 
-  size_t len = buff.size();
-  if (len >= maxLen) {
-    len = maxLen - 1; // leave space for null terminator
+bool JsonCompilePresenceTemplate(PresenceTemplate &tmpl, const int pid, const DiscordRichPresence *presence, const int openFields) {
+  tmpl.holeCount = 0;
+  if (!presence) {
+    return false;
   }
 
-  std::memcpy(dest, buff.data(), len);
-  dest[len] = '\0';
+  DiscordRichPresence base = *presence;
+  if (openFields & DISCORD_PRESENCE_STATE) {
+    base.state = "#";
+  }
+  if (openFields & DISCORD_PRESENCE_DETAILS) {
+    base.details = "#";
+  }
+  if (openFields & DISCORD_PRESENCE_TIMESTAMPS) {
+    base.startTimestamp = 1;
+    base.endTimestamp = 0;
+  }
 
-  return len;
+  std::string json(MaxTemplateSize, '\0');
+  const size_t len = JsonWriteRichPresenceObj(json.data(), json.size(), 0, pid, &base);
+  if (!len || len >= json.size() - 1 || !std::string_view(json.data(), len).starts_with(NoncePlaceholder)) {
+    return false;
+  }
+  json.resize(len);
+
+  // the nonce hole only swallows the 0
+  TemplateCut cuts[4]{{NoncePlaceholder.size() - 2, 1, PresenceTemplate::Slot::Nonce}};
+  size_t count = 1;
+  if (((openFields & DISCORD_PRESENCE_STATE) && !FindPlaceholder(json, R"("state":"#",)", PresenceTemplate::Slot::State, cuts, count)) ||
+      ((openFields & DISCORD_PRESENCE_DETAILS) && !FindPlaceholder(json, R"("details":"#",)", PresenceTemplate::Slot::Details, cuts, count)) ||
+      ((openFields & DISCORD_PRESENCE_TIMESTAMPS) && !FindPlaceholder(json, R"("timestamps":{"start":1},)", PresenceTemplate::Slot::Timestamps, cuts, count))) {
+    return false;
+  }
+  std::sort(cuts, cuts + count, [](const TemplateCut &a, const TemplateCut &b) { return a.offset < b.offset; });
+
+  tmpl.skeleton.clear();
+  size_t from = 0;
+  for (size_t i = 0; i < count; ++i) {
+    tmpl.skeleton.append(json, from, cuts[i].offset - from);
+    tmpl.holes[i] = {tmpl.skeleton.size(), cuts[i].slot};
+    from = cuts[i].offset + cuts[i].length;
+  }
+  tmpl.skeleton.append(json, from);
+  tmpl.holeCount = count;
+
+  tmpl.hash = FnvOffsetBasis;
+  HashBytes(tmpl.hash, tmpl.skeleton.data(), tmpl.skeleton.size());
+  return true;
 }
 
-size_t JsonWriteSubscribeCommand(char *dest, size_t maxLen, int nonce, const char *evtName) {
-  glz::json_t message;
-  message["nonce"] = (double)nonce;
-  message["cmd"] = std::string("SUBSCRIBE");
-  message["evt"] = std::string(evtName);
+static bool Append(char *&out, const char *end, std::string_view text) {
+  if (static_cast<size_t>(end - out) < text.size()) {
+    return false;
+  }
+  std::memcpy(out, text.data(), text.size());
+  out += text.size();
+  return true;
+}
 
+// Same deal as WriteCommand: straight into the buffer when it surely fits.
+template <typename T> static bool AppendJson(char *&out, const char *end, const T &value, const size_t bound) {
+  if (bound < static_cast<size_t>(end - out)) {
+    const auto written = glz::write<glz::opts{}>(value, out);
+    if (!written) {
+      return false;
+    }
+    out += *written;
+    return true;
+  }
   std::string buff{};
-  const auto ec = glz::write_json(message, buff);
-  assert(!ec);
+  return !glz::write<glz::opts{}>(value, buff) && Append(out, end, buff);
+}
 
-  size_t len = buff.size();
-  if (len >= maxLen) {
-    len = maxLen - 1;
+static bool AppendMember(char *&out, const char *end, std::string_view key, const char *str) {
+  if (!str) {
+    return true;
   }
+  const std::string_view text(str);
+  if (static_cast<size_t>(end - out) < key.size() + JsonEscapedBound(std::min(text.size(), MaxTextBytes)) + 1) {
+    return false;
+  }
+  Append(out, end, key);
+  out += EscapeText(out, text, MaxTextBytes);
+  return Append(out, end, ",");
+}
 
-  std::memcpy(dest, buff.data(), len);
-  dest[len] = '\0';
+size_t JsonWritePresenceFromTemplate(char *dest, const size_t maxLen, const PresenceTemplate &tmpl, const int nonce, const DiscordPresenceFields *fields) {
+  if (!maxLen || !tmpl.holeCount) {
+    return 0;
+  }
+  const DiscordPresenceFields none{};
+  if (!fields) {
+    fields = &none;
+  }
 
-  return len;
+  char *out = dest;
+  char *const end = dest + maxLen - 1; // leave space for null terminator
+  bool fits = true;
+  size_t from = 0;
+  for (size_t i = 0; fits && i < tmpl.holeCount; ++i) {
+    const auto &hole = tmpl.holes[i];
+    fits = Append(out, end, std::string_view(tmpl.skeleton).substr(from, hole.offset - from));
+    from = hole.offset;
+    switch (hole.slot) {
+    case PresenceTemplate::Slot::Nonce: {
+      const auto res = std::to_chars(out, end, nonce);
+      fits = fits && res.ec == std::errc{};
+      if (fits) {
+        out = res.ptr;
+      }
+      break;
+    }
+    case PresenceTemplate::Slot::State:
+      fits = fits && AppendMember(out, end, R"("state":)", fields->state);
+      break;
+    case PresenceTemplate::Slot::Details:
+      fits = fits && AppendMember(out, end, R"("details":)", fields->details);
+      break;
+    case PresenceTemplate::Slot::Timestamps:
+      if (fits && (fields->startTimestamp || fields->endTimestamp)) {
+        ActivityTimestamps timestamps;
+        if (fields->startTimestamp) {
+          timestamps.start = fields->startTimestamp;
+        }
+        if (fields->endTimestamp) {
+          timestamps.end = fields->endTimestamp;
+        }
+        fits = Append(out, end, R"("timestamps":)") && AppendJson(out, end, timestamps, 64) && Append(out, end, ",");
+      }
+      break;
+    }
+  }
+  fits = fits && Append(out, end, std::string_view(tmpl.skeleton).substr(from));
+
+  if (!fits) {
+    // a cut off document is no use to anyone
+    dest[0] = '\0';
+    return 0;
+  }
+  *out = '\0';
+  return static_cast<size_t>(out - dest);
+}
+
+uint64_t PresenceFieldsHash(const PresenceTemplate &tmpl, const DiscordPresenceFields *fields) {
+  uint64_t hash = tmpl.hash;
+  if (fields) {
+    HashString(hash, fields->state);
+    HashString(hash, fields->details);
+    HashValue(hash, fields->startTimestamp);
+    HashValue(hash, fields->endTimestamp);
+  }
+  return hash ? hash : 1;
+}
+
+size_t JsonWriteHandshakeObj(char *dest, const size_t maxLen, int version, const char *applicationId) {
+  return WriteCommand(dest, maxLen, HandshakeObj{version, applicationId}, EscapedBound(applicationId));
+}
+
+size_t JsonWriteSubscribeCommand(char *dest, size_t maxLen, int nonce, const char *evtName) {
+  return WriteCommand(dest, maxLen, SubscriptionCommand{nonce, "SUBSCRIBE", evtName}, EscapedBound(evtName));
 }
 
 size_t JsonWriteUnsubscribeCommand(char *dest, const size_t maxLen, int nonce, const char *evtName) {
-  glz::json_t message;
-  message["nonce"] = (double)nonce;
-  message["cmd"] = std::string("UNSUBSCRIBE");
-  message["evt"] = std::string(evtName);
+  return WriteCommand(dest, maxLen, SubscriptionCommand{nonce, "UNSUBSCRIBE", evtName}, EscapedBound(evtName));
+}
 
-  std::string buff{};
-  const auto ec = glz::write_json(message, buff);
-  assert(!ec);
+size_t JsonWriteJoinReply(char *dest, const size_t maxLen, const char *userId, const int reply, const int nonce) {
+  const std::string_view cmd = reply == DISCORD_REPLY_YES ? "SEND_ACTIVITY_JOIN_INVITE" : "CLOSE_ACTIVITY_JOIN_REQUEST";
+  return WriteCommand(dest, maxLen, JoinReplyCommand{nonce, cmd, {userId}}, EscapedBound(userId));
+}
 
-  size_t len = buff.size();
-  if (len >= maxLen) {
-    len = maxLen - 1;
+size_t JsonWriteCommandHead(char *dest, const size_t maxLen, const int nonce, const std::string_view cmd) {
+  const bool valid = !cmd.empty() && std::ranges::all_of(cmd, [](const char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+  });
+  if (!valid) {
+    return 0;
+  }
+  char *out = dest;
+  const char *const end = dest + maxLen;
+  bool fits = Append(out, end, R"({"nonce":)");
+  if (fits) {
+    const auto res = std::to_chars(out, dest + maxLen, nonce);
+    fits = res.ec == std::errc{};
+    out = res.ptr;
   }
+  fits = fits && Append(out, end, R"(,"cmd":")") && Append(out, end, cmd) && Append(out, end, R"(","args":)");
+  return fits ? static_cast<size_t>(out - dest) : 0;
+}
 
-  std::memcpy(dest, buff.data(), len);
-  dest[len] = '\0';
+// Incoming messages, parsed in place; anything we don't know about is
+// skipped.
+
+constexpr glz::opts ReadOpts{.null_terminated = false, .error_on_unknown_keys = false};
+
+struct MessageIn {
+  std::optional<std::string_view> cmd;
+  std::optional<std::string_view> evt;
+  glz::raw_json_view nonce;
+  glz::raw_json_view data;
+};
+
+struct UserIn {
+  std::optional<std::string_view> id;
+  std::optional<std::string_view> username;
+  std::optional<std::string_view> discriminator;
+  std::optional<std::string_view> avatar;
+};
+
+struct UserEventIn {
+  std::optional<UserIn> user;
+};
+
+struct SecretEventIn {
+  std::optional<std::string_view> secret;
+};
+
+struct ErrorIn {
+  int code{0};
+  std::optional<std::string_view> message;
+};
+
+// Index of the quote closing the string whose body starts at pos, or npos.
+static size_t SkipJsonString(std::string_view json, size_t pos) {
+  while (pos < json.size()) {
+    const char c = json[pos];
+    if (c == '"') {
+      return pos;
+    }
+    pos += c == '\\' ? 2 : 1;
+  }
+  return std::string_view::npos;
+}
 
-  return len;
+static size_t SkipJsonSpace(std::string_view json, size_t pos) {
+  while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r')) {
+    ++pos;
+  }
+  return pos;
 }
 
-size_t JsonWriteJoinReply(char *dest, const size_t maxLen, const char *userId, const int reply, const int nonce) {
-  glz::json_t message;
-  message["cmd"] = reply == DISCORD_REPLY_YES ? std::string("SEND_ACTIVITY_JOIN_INVITE") : std::string("CLOSE_ACTIVITY_JOIN_REQUEST");
-  message["nonce"] = (double)nonce;
-  message["args"]["user_id"] = std::string(userId);
+// We write nonces as numbers, but take them back quoted too.
+static int ReadNonce(std::string_view value) {
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+    value = value.substr(1, value.size() - 2);
+  }
+  int nonce = 0;
+  const auto res = std::from_chars(value.data(), value.data() + value.size(), nonce);
+  return res.ec == std::errc{} && res.ptr == value.data() + value.size() ? nonce : 0;
+}
 
-  std::string buff{};
-  const auto ec = glz::write_json(message, buff);
-  assert(!ec);
+bool JsonPeekMessage(std::string_view json, std::string_view &evt, bool &hasNonce, int &nonce) {
+  evt = {};
+  hasNonce = false;
+  nonce = 0;
+  bool sawEvt = false;
+  bool sawNonce = false;
+  int depth = 0;
+  bool expectKey = false;
+  size_t i = 0;
+  while (i < json.size() && !(sawEvt && sawNonce)) {
+    const char c = json[i];
+    if (c == '"') {
+      const size_t end = SkipJsonString(json, i + 1);
+      if (end == std::string_view::npos) {
+        return false;
+      }
+      const std::string_view str = json.substr(i + 1, end - i - 1);
+      i = end + 1;
+      if (depth != 1 || !expectKey) {
+        continue;
+      }
+      expectKey = false;
+      i = SkipJsonSpace(json, i);
+      if (i >= json.size() || json[i] != ':') {
+        return false;
+      }
+      i = SkipJsonSpace(json, i + 1);
+      if (str == "evt") {
+        sawEvt = true;
+        if (i < json.size() && json[i] == '"') {
+          const size_t valueEnd = SkipJsonString(json, i + 1);
+          if (valueEnd == std::string_view::npos) {
+            return false;
+          }
+          evt = json.substr(i + 1, valueEnd - i - 1);
+          i = valueEnd + 1;
+        }
+      } else if (str == "nonce") {
+        sawNonce = true;
+        hasNonce = json.substr(i, 4) != "null";
+        size_t valueEnd = i;
+        if (valueEnd < json.size() && json[valueEnd] == '"') {
+          valueEnd = SkipJsonString(json, valueEnd + 1);
+          if (valueEnd == std::string_view::npos) {
+            return false;
+          }
+          ++valueEnd;
+        } else {
+          while (valueEnd < json.size() && std::string_view{",} \t\r\n"}.find(json[valueEnd]) == std::string_view::npos) {
+            ++valueEnd;
+          }
+        }
+        if (hasNonce) {
+          nonce = ReadNonce(json.substr(i, valueEnd - i));
+        }
+        i = valueEnd;
+      }
+      continue;
+    }
+    switch (c) {
+    case '{':
+      expectKey = ++depth == 1;
+      break;
+    case '[':
+      ++depth;
+      break;
+    case '}':
+    case ']':
+      --depth;
+      break;
+    case ',':
+      expectKey = depth == 1;
+      break;
+    default:
+      break;
+    }
+    ++i;
+  }
+  return depth >= 0;
+}
 
-  size_t len = buff.size();
-  if (len >= maxLen) {
-    len = maxLen - 1;
+bool JsonReadMessage(std::string_view json, RpcMessage &message) {
+  MessageIn in{};
+  if (glz::read<ReadOpts>(in, json)) {
+    return false;
   }
+  message.cmd = in.cmd.value_or(std::string_view{});
+  message.evt = in.evt.value_or(std::string_view{});
+  message.data = in.data.str;
+  message.hasNonce = !in.nonce.str.empty() && in.nonce.str != "null";
+  message.nonce = message.hasNonce ? ReadNonce(in.nonce.str) : 0;
+  return true;
+}
 
-  std::memcpy(dest, buff.data(), len);
-  dest[len] = '\0';
+bool JsonReadData(std::string_view json, UserEventData &data) {
+  UserEventIn in{};
+  if (json.empty() || glz::read<ReadOpts>(in, json)) {
+    return false;
+  }
+  data = {};
+  if (in.user) {
+    data.user.id = in.user->id.value_or(std::string_view{});
+    data.user.username = in.user->username.value_or(std::string_view{});
+    data.user.discriminator = in.user->discriminator.value_or(std::string_view{});
+    data.user.avatar = in.user->avatar.value_or(std::string_view{});
+  }
+  return true;
+}
 
-  return len;
+bool JsonReadData(std::string_view json, SecretEventData &data) {
+  SecretEventIn in{};
+  if (json.empty() || glz::read<ReadOpts>(in, json)) {
+    return false;
+  }
+  data.secret = in.secret.value_or(std::string_view{});
+  return true;
+}
+
+bool JsonReadData(std::string_view json, ErrorData &data) {
+  ErrorIn in{};
+  if (json.empty() || glz::read<ReadOpts>(in, json)) {
+    return false;
+  }
+  data.code = in.code;
+  data.message = in.message.value_or(std::string_view{});
+  return true;
+}
+
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Reads the XXXX of a \uXXXX escape starting at src[pos].
+static int32_t ReadHex4(std::string_view src, size_t pos) {
+  if (pos + 4 > src.size()) {
+    return -1;
+  }
+  int32_t value = 0;
+  for (size_t i = pos; i < pos + 4; ++i) {
+    const int digit = HexValue(src[i]);
+    if (digit < 0) {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+static size_t EncodeUtf8(char *out, uint32_t cp) {
+  if (cp < 0x80) {
+    out[0] = static_cast<char>(cp);
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = static_cast<char>(0xC0 | (cp >> 6));
+    out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = static_cast<char>(0xE0 | (cp >> 12));
+    out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = static_cast<char>(0xF0 | (cp >> 18));
+  out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+size_t JsonUnescape(char *dest, const size_t maxLen, std::string_view src) {
+  if (!maxLen) {
+    return 0;
+  }
+  size_t out = 0;
+  size_t i = 0;
+  while (i < src.size()) {
+    char decoded[4];
+    size_t decodedLen = 1;
+    if (src[i] != '\\' || i + 1 >= src.size()) {
+      // a raw multibyte character is copied whole, like a \u escape
+      decoded[0] = src[i++];
+      const auto lead = static_cast<unsigned char>(decoded[0]);
+      const size_t expected = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+      while (decodedLen < expected && i < src.size() && (static_cast<unsigned char>(src[i]) & 0xC0) == 0x80) {
+        decoded[decodedLen++] = src[i++];
+      }
+    } else {
+      const char escape = src[i + 1];
+      i += 2;
+      switch (escape) {
+      case 'b':
+        decoded[0] = '\b';
+        break;
+      case 'f':
+        decoded[0] = '\f';
+        break;
+      case 'n':
+        decoded[0] = '\n';
+        break;
+      case 'r':
+        decoded[0] = '\r';
+        break;
+      case 't':
+        decoded[0] = '\t';
+        break;
+      case 'u': {
+        int32_t cp = ReadHex4(src, i);
+        if (cp < 0) {
+          cp = 0xFFFD;
+        } else {
+          i += 4;
+          if (cp >= 0xD800 && cp <= 0xDBFF) {
+            const int32_t low = (i + 1 < src.size() && src[i] == '\\' && src[i + 1] == 'u') ? ReadHex4(src, i + 2) : -1;
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+              i += 6;
+            } else {
+              cp = 0xFFFD;
+            }
+          } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            cp = 0xFFFD;
+          }
+        }
+        decodedLen = EncodeUtf8(decoded, static_cast<uint32_t>(cp));
+        break;
+      }
+      default: // \" \\ \/
+        decoded[0] = escape;
+        break;
+      }
+    }
+    if (out + decodedLen >= maxLen) {
+      break;
+    }
+    std::memcpy(dest + out, decoded, decodedLen);
+    out += decodedLen;
+  }
+  dest[out] = 0;
+  return out;
 }
 
 #pragma warning(pop)
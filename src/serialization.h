@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <string_view>
 
 #ifndef __MINGW32__
 #pragma warning(push)
@@ -30,11 +33,92 @@ template <size_t Len> size_t StringCopy(char (&dest)[Len], const char *src) {
   return copied - 1;
 }
 
+// Undoes JSON string escapes while copying; never cuts a character in half.
+size_t JsonUnescape(char *dest, size_t maxLen, std::string_view src);
+
+template <size_t Len> size_t JsonStringCopy(char (&dest)[Len], std::string_view src) {
+  return JsonUnescape(dest, Len, src);
+}
+
+// Incoming messages. All the strings point into the frame they were parsed
+// from and are still escaped, copy them out with JsonStringCopy. Missing or
+// null members come out empty.
+struct RpcMessage {
+  std::string_view cmd;
+  std::string_view evt;
+  std::string_view data; // unparsed
+  bool hasNonce{false};  // only responses to our commands carry one
+  int nonce{0};          // 0 unless it's one we could have written
+};
+
+struct UserData {
+  std::string_view id;
+  std::string_view username;
+  std::string_view discriminator;
+  std::string_view avatar;
+};
+
+// READY and ACTIVITY_JOIN_REQUEST
+struct UserEventData {
+  UserData user;
+};
+
+// ACTIVITY_JOIN and ACTIVITY_SPECTATE
+struct SecretEventData {
+  std::string_view secret;
+};
+
+// ERROR responses and close frames
+struct ErrorData {
+  int code{0};
+  std::string_view message;
+};
+
+// Finds the top level evt and nonce of a message without parsing it, so frames
+// nobody listens to can be dropped early. False if the scan gave up.
+bool JsonPeekMessage(std::string_view json, std::string_view &evt, bool &hasNonce, int &nonce);
+bool JsonReadMessage(std::string_view json, RpcMessage &message);
+bool JsonReadData(std::string_view json, UserEventData &data);
+bool JsonReadData(std::string_view json, SecretEventData &data);
+bool JsonReadData(std::string_view json, ErrorData &data);
+
 size_t JsonWriteHandshakeObj(char *dest, size_t maxLen, int version, const char *applicationId);
 
 // Commands
 struct DiscordRichPresence;
+struct DiscordRichPresenceEx;
 size_t JsonWriteRichPresenceObj(char *dest, size_t maxLen, int nonce, int pid, const DiscordRichPresence *presence);
+size_t JsonWriteRichPresenceObj(char *dest, size_t maxLen, int nonce, int pid, const DiscordRichPresenceEx *presence);
+// Changes whenever the activity JsonWriteRichPresenceObj writes would, never 0.
+uint64_t RichPresenceHash(const DiscordRichPresence *presence);
+uint64_t RichPresenceHash(const DiscordRichPresenceEx *presence);
+
+// A SET_ACTIVITY written once, with holes where the nonce and the fields left
+// open (DISCORD_PRESENCE_* flags) go. Filling those in is all a later update
+// has to do.
+struct PresenceTemplate {
+  enum class Slot : uint8_t { Nonce, State, Details, Timestamps };
+  struct Hole {
+    size_t offset;
+    Slot slot;
+  };
+  std::string skeleton;
+  Hole holes[4];
+  size_t holeCount{0}; // 0 until compiled
+  uint64_t hash{0};
+};
+struct DiscordPresenceFields;
+bool JsonCompilePresenceTemplate(PresenceTemplate &tmpl, int pid, const DiscordRichPresence *presence, int openFields);
+size_t JsonWritePresenceFromTemplate(char *dest, size_t maxLen, const PresenceTemplate &tmpl, int nonce, const DiscordPresenceFields *fields);
+// Same idea as RichPresenceHash, for a template and what goes in its holes.
+uint64_t PresenceFieldsHash(const PresenceTemplate &tmpl, const DiscordPresenceFields *fields);
+// Presence strings cut down to their documented maximum so far.
+uint64_t JsonTruncatedStrings();
+
 size_t JsonWriteSubscribeCommand(char *dest, size_t maxLen, int nonce, const char *evtName);
 size_t JsonWriteUnsubscribeCommand(char *dest, size_t maxLen, int nonce, const char *evtName);
-size_t JsonWriteJoinReply(char *dest, size_t maxLen, const char *userId, int reply, int nonce);
\ No newline at end of file
+size_t JsonWriteJoinReply(char *dest, size_t maxLen, const char *userId, int reply, int nonce);
+// Everything of a command up to its args, `{"nonce":1,"cmd":"CMD","args":`;
+// the caller adds the args and the closing brace. 0 unless cmd is made of
+// A-Z, 0-9 and _ only.
+size_t JsonWriteCommandHead(char *dest, size_t maxLen, int nonce, std::string_view cmd);
\ No newline at end of file
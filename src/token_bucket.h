@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+// Allows bursts of up to `burst` events, refilled at one token per `interval`.
+// Time is always passed in, so the caller decides which clock drives it.
+struct TokenBucket {
+  using Clock = std::chrono::steady_clock;
+
+  int burst;
+  Clock::duration interval;
+  int tokens;
+  Clock::time_point lastRefill;
+
+  TokenBucket(const int burstSize, const Clock::duration refillInterval, const Clock::time_point now)
+      : burst(burstSize), interval(refillInterval), tokens(burstSize), lastRefill(now) {}
+
+  // A zero or negative interval turns limiting off.
+  bool limited() const { return interval > Clock::duration::zero() && burst > 0; }
+
+  // Starts over full if the settings changed.
+  void configure(const int burstSize, const Clock::duration refillInterval, const Clock::time_point now) {
+    if (burstSize != burst || refillInterval != interval) {
+      burst = burstSize;
+      interval = refillInterval;
+      tokens = burstSize;
+      lastRefill = now;
+    }
+  }
+
+  void refill(const Clock::time_point now) {
+    if (!limited() || tokens >= burst) {
+      lastRefill = now;
+      return;
+    }
+    const auto earned = (now - lastRefill) / interval;
+    if (earned > 0) {
+      tokens = static_cast<int>(std::min<decltype(earned)>(burst, tokens + earned));
+      lastRefill = tokens >= burst ? now : lastRefill + earned * interval;
+    }
+  }
+
+  bool ready(const Clock::time_point now) {
+    refill(now);
+    return !limited() || tokens > 0;
+  }
+
+  // Only call after ready() said yes.
+  void take() {
+    if (limited() && tokens > 0) {
+      --tokens;
+    }
+  }
+
+  // When ready() will next say yes.
+  Clock::time_point nextReady(const Clock::time_point now) {
+    return ready(now) ? now : lastRefill + interval;
+  }
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+// Latest-wins hand-off to a single consumer, without locks. A producer fills
+// a buffer nobody else is using and publishes it with one atomic exchange;
+// whatever was published before and not yet taken is simply recycled. The
+// consumer takes the newest published buffer and owns it until it gives it
+// back. With one producer that's the classic triple buffer (one being
+// written, one published, one being read); each extra producer writing at
+// the same moment needs one more buffer, so size ProducerCount for that.
+
+template <typename ElementType, unsigned ProducerCount = 2> class TripleBuffer {
+  static constexpr unsigned BufferCount = ProducerCount + 2;
+  static constexpr unsigned None = BufferCount;
+  static_assert(BufferCount <= 32, "in use flags are a 32 bit mask");
+
+  ElementType buffers_[BufferCount];
+  std::atomic_uint inUse_{0};
+  std::atomic_uint published_{None};
+
+  unsigned IndexOf(const ElementType *buffer) const {
+    return static_cast<unsigned>(buffer - buffers_);
+  }
+
+public:
+  TripleBuffer() {}
+
+  // Producer side. Only waits if more than ProducerCount threads are writing
+  // at the same time.
+  ElementType *BeginWrite() {
+    for (;;) {
+      unsigned used = inUse_.load();
+      for (unsigned i = 0; i < BufferCount; ++i) {
+        const unsigned bit = 1u << i;
+        if (!(used & bit) && inUse_.compare_exchange_weak(used, used | bit)) {
+          return &buffers_[i];
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+  // Returns true if this replaced a buffer the consumer never got to see.
+  bool Publish(ElementType *buffer) {
+    const unsigned previous = published_.exchange(IndexOf(buffer));
+    if (previous != None) {
+      inUse_.fetch_and(~(1u << previous));
+      return true;
+    }
+    return false;
+  }
+
+  // Consumer side. The returned buffer stays valid until it is handed back
+  // with Release(), so it can be kept around to send again later.
+  ElementType *TakeLatest() {
+    const unsigned index = published_.exchange(None);
+    return index != None ? &buffers_[index] : nullptr;
+  }
+  void Release(ElementType *buffer) { inUse_.fetch_and(~(1u << IndexOf(buffer))); }
+  // Whether TakeLatest() would return something right now.
+  bool HasPublished() const { return published_.load() != None; }
+
+  // Only when nothing is going on any more.
+  void Reset() {
+    published_.store(None);
+    inUse_.store(0);
+  }
+};
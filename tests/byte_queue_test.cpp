@@ -0,0 +1,131 @@
+// Checks for the lock-free send queue: a fresh queue has nothing in it, and
+// several producers against one consumer never lose, reorder or tear a
+// message. Worth running under ThreadSanitizer after touching byte_queue.h.
+
+#include "byte_queue.h"
+#include "command_queue.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int Failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+      ++Failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+static void FreshByteQueueIsEmpty() {
+  static ByteQueue<1024> queue;
+  CHECK(!queue.HavePendingSends());
+  size_t position = queue.BeginSend();
+  std::string_view message;
+  CHECK(!queue.PeekSend(position, message));
+  queue.EndSend(position);
+
+  const std::string_view part{"hello"};
+  CHECK(queue.Add({&part, 1}, false) == ByteQueue<1024>::AddResult::Added);
+  CHECK(queue.HavePendingSends());
+  position = queue.BeginSend();
+  CHECK(queue.PeekSend(position, message) && message == part);
+  CHECK(!queue.PeekSend(position, message));
+  queue.EndSend(position);
+  CHECK(!queue.HavePendingSends());
+}
+
+static void FreshCommandQueueIsEmpty() {
+  using Queue = CommandQueue<8192, 16>;
+  static Queue queue;
+  IoSlice slices[16];
+  RequestInfo infos[16];
+  CHECK(!queue.HavePendingSends());
+  CHECK(queue.BeginSend(slices, infos, 16) == 0);
+  queue.EndSend(0);
+
+  size_t cleared = 0;
+  queue.Clear([&](const RequestInfo &) { ++cleared; });
+  CHECK(cleared == 0);
+
+  // and it keeps working once it has lapped the ring a few times
+  for (int i = 1; i <= 2000; ++i) {
+    const std::string command = "command " + std::to_string(i);
+    CHECK(queue.Add(RequestInfo{i}, command.data(), command.size(), false) == Queue::Result::Queued);
+    CHECK(queue.BeginSend(slices, infos, 16) == 1);
+    CHECK(infos[0].nonce == i);
+    CHECK(std::string_view(static_cast<const char *>(slices[0].data), slices[0].length) == command);
+    queue.EndSend(1);
+  }
+  CHECK(!queue.HavePendingSends());
+}
+
+// Each message is a producer id and a sequence number followed by filler of
+// a length that depends on both, so the consumer can check every byte.
+static void ManyProducersOneConsumer() {
+  static ByteQueue<1024> queue;
+  constexpr int Producers = 4;
+  constexpr int PerProducer = 20000;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < Producers; ++p) {
+    producers.emplace_back([p] {
+      char buffer[64];
+      for (int i = 0; i < PerProducer;) {
+        const size_t length = 8 + (i + p) % 40;
+        std::memcpy(buffer, &p, sizeof(p));
+        std::memcpy(buffer + 4, &i, sizeof(i));
+        std::memset(buffer + 8, 'a' + p, length - 8);
+        const std::string_view part{buffer, length};
+        if (queue.Add({&part, 1}, false) == ByteQueue<1024>::AddResult::Full) {
+          std::this_thread::yield();
+          continue;
+        }
+        ++i;
+      }
+    });
+  }
+
+  int next[Producers]{};
+  long received = 0;
+  while (received < long{Producers} * PerProducer && !Failures) {
+    size_t position = queue.BeginSend();
+    std::string_view message;
+    while (queue.PeekSend(position, message) && !Failures) {
+      int p;
+      int i;
+      CHECK(message.size() >= 8);
+      std::memcpy(&p, message.data(), sizeof(p));
+      std::memcpy(&i, message.data() + 4, sizeof(i));
+      CHECK(p >= 0 && p < Producers);
+      if (Failures) {
+        break;
+      }
+      CHECK(i == next[p]);
+      CHECK(message.size() == static_cast<size_t>(8 + (i + p) % 40));
+      CHECK(message.find_first_not_of(static_cast<char>('a' + p), 8) == std::string_view::npos);
+      ++next[p];
+      ++received;
+    }
+    queue.EndSend(position);
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  CHECK(!queue.HavePendingSends());
+}
+
+int main() {
+  FreshByteQueueIsEmpty();
+  FreshCommandQueueIsEmpty();
+  ManyProducersOneConsumer();
+  if (Failures) {
+    std::fprintf(stderr, "%d checks failed\n", Failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Walks a command through what the io thread does with it: queued after a
+// few passes found nothing to send, written, tracked until the reply, and
+// answered exactly once. Whatever is still queued or unanswered at shutdown
+// is answered once too, and queues that never held anything answer nothing.
+
+#include "command_queue.h"
+#include "pending_requests.h"
+
+#include <cstdio>
+#include <string>
+
+static int Failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+      ++Failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+using Queue = CommandQueue<8192, 16>;
+using Requests = PendingRequests<64>;
+
+struct Answers {
+  int ok{0};
+  int disconnected{0};
+};
+
+static void Answered(void *userdata, int result, const char *, uint32_t) {
+  auto *answers = static_cast<Answers *>(userdata);
+  if (result == static_cast<int>(RequestResult::Ok)) {
+    ++answers->ok;
+  } else if (result == static_cast<int>(RequestResult::Disconnected)) {
+    ++answers->disconnected;
+  }
+}
+
+static void Finish(const RequestInfo &info, const RequestResult result) {
+  if (info.callback) {
+    info.callback(info.userdata, static_cast<int>(result), nullptr, 0);
+  }
+}
+
+// One pass of the io thread's write loop, with every frame taken.
+static size_t WritePass(Queue &queue, Requests &requests) {
+  IoSlice slices[16];
+  RequestInfo infos[16];
+  const size_t count = queue.BeginSend(slices, infos, 16);
+  queue.EndSend(count);
+  for (size_t i = 0; i < count; ++i) {
+    Requests::Entry evicted;
+    requests.Insert(infos[i], Requests::Clock::now(), evicted);
+  }
+  return count;
+}
+
+static void CommandAfterReadyGetsItsReply() {
+  static Queue queue;
+  Requests requests;
+  Answers answers;
+
+  // the passes right after READY, nothing queued yet
+  CHECK(WritePass(queue, requests) == 0);
+  CHECK(WritePass(queue, requests) == 0);
+
+  const std::string command = R"({"nonce":1,"cmd":"GET_CHANNELS","args":{}})";
+  CHECK(queue.Add(RequestInfo{1, CommandKind::Other, Answered, &answers}, command.data(), command.size(), false) ==
+        Queue::Result::Queued);
+  CHECK(WritePass(queue, requests) == 1);
+  CHECK(requests.Count() == 1);
+
+  Requests::Entry entry;
+  CHECK(requests.Take(1, entry));
+  Finish(entry.info, RequestResult::Ok);
+  CHECK(answers.ok == 1 && answers.disconnected == 0);
+  CHECK(!requests.Take(1, entry));
+}
+
+static void ShutdownAnswersEverythingOnce() {
+  static Queue unused;
+  static Queue queue;
+  Requests requests;
+  Answers answers;
+
+  const std::string command = "{}";
+  CHECK(queue.Add(RequestInfo{1, CommandKind::Other, Answered, &answers}, command.data(), command.size(), false) ==
+        Queue::Result::Queued);
+  CHECK(WritePass(queue, requests) == 1);
+  CHECK(queue.Add(RequestInfo{2, CommandKind::Other, Answered, &answers}, command.data(), command.size(), false) ==
+        Queue::Result::Queued);
+
+  int cleared = 0;
+  requests.Clear([&](const Requests::Entry &request) {
+    ++cleared;
+    Finish(request.info, RequestResult::Disconnected);
+  });
+  const auto unsent = [&](const RequestInfo &info) {
+    ++cleared;
+    Finish(info, RequestResult::Disconnected);
+  };
+  unused.Clear(unsent);
+  queue.Clear(unsent);
+  CHECK(cleared == 2);
+  CHECK(answers.disconnected == 2 && answers.ok == 0);
+  CHECK(!queue.HavePendingSends() && !unused.HavePendingSends());
+}
+
+int main() {
+  CommandAfterReadyGetsItsReply();
+  ShutdownAnswersEverythingOnce();
+  if (Failures) {
+    std::fprintf(stderr, "%d checks failed\n", Failures);
+    return 1;
+  }
+  return 0;
+}